@@ -0,0 +1,98 @@
+// NNBackendPool.cpp
+#include "NNBackendPool.hpp"
+#include "SC_InterfaceTable.h"
+
+extern InterfaceTable* ft;
+
+namespace NN {
+
+BackendPool::~BackendPool() {
+  for (auto& kv: m_idle)
+    for (auto backend: kv.second) delete backend;
+}
+
+bool BackendPool::fill(const NNModelDesc* modelDesc, const NNModelMethod* modelMethod,
+                       int bufferSize, int count, int warmup) {
+  Key key(modelDesc->getSerial(), modelMethod, bufferSize);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  int missing = count - m_idle[key].size();
+  lock.unlock();
+
+  auto shared = modelDesc->getBackend();
+  if (!shared) {
+    Print("NNBackendPool: model %s not loaded\n", modelDesc->getPath());
+    return false;
+  }
+
+  // silent blocks for warmup
+  std::vector<float> inModel(modelMethod->inSize(bufferSize), 0);
+  std::vector<float> outModel(modelMethod->outSize(bufferSize), 0);
+
+  for (int i = 0; i < missing; ++i) {
+    auto backend = new Backend();
+    PerformBlock block;
+    if (backend->load(*shared) ||
+        !backend->bind(block, modelMethod->name, inModel.data(), outModel.data(),
+                       bufferSize, 1, modelMethod->inDim, modelMethod->inRatio,
+                       modelMethod->outDim, modelMethod->outRatio)) {
+      Print("NNBackendPool: ERROR loading %s\n", modelDesc->getPath());
+      delete backend;
+      return false;
+    }
+    backend->set_num_threads(modelDesc->getThreads(modelMethod));
+    backend->save_state();
+    for (int n = 0; n < warmup; ++n)
+      backend->perform(block);
+    // warmup passes shouldn't leave any trace in model state
+    backend->reset_state();
+
+    lock.lock();
+    m_idle[key].push_back(backend);
+    lock.unlock();
+  }
+  return true;
+}
+
+void BackendPool::clear(const NNModelDesc* modelDesc) {
+  std::vector<Backend*> dropped;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (auto it = m_idle.begin(); it != m_idle.end();) {
+    if (std::get<0>(it->first) != modelDesc->getSerial()) { ++it; continue; }
+    dropped.insert(dropped.end(), it->second.begin(), it->second.end());
+    it = m_idle.erase(it);
+  }
+  lock.unlock();
+  for (auto backend: dropped) delete backend;
+}
+
+Backend* BackendPool::checkout(const NNModelDesc* modelDesc,
+                               const NNModelMethod* modelMethod, int bufferSize) {
+  std::unique_lock<std::mutex> lock(m_mutex, std::try_to_lock);
+  if (!lock.owns_lock()) return nullptr;
+  auto found = m_idle.find(Key(modelDesc->getSerial(), modelMethod, bufferSize));
+  if (found == m_idle.end() || found->second.empty()) return nullptr;
+  auto backend = found->second.back();
+  found->second.pop_back();
+  return backend;
+}
+
+void BackendPool::checkin(const NNModelDesc* modelDesc,
+                          const NNModelMethod* modelMethod,
+                          int bufferSize, Backend* backend) {
+  // only pooled instances know how to reset their state
+  if (!backend->has_saved_state()) {
+    delete backend;
+    return;
+  }
+  backend->reset_state();
+  std::unique_lock<std::mutex> lock(m_mutex);
+  auto found = m_idle.find(Key(modelDesc->getSerial(), modelMethod, bufferSize));
+  if (found != m_idle.end()) {
+    found->second.push_back(backend);
+    return;
+  }
+  lock.unlock();
+  delete backend;
+}
+
+} // namespace NN
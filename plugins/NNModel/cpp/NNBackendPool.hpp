@@ -0,0 +1,45 @@
+// NNBackendPool.hpp
+
+#pragma once
+#include "NNModel.hpp"
+#include "backend/backend.h"
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+namespace NN {
+
+// loaded and warmed up model instances, ready for UGens to use
+// without waiting for load and warmup. Keyed by model, method and
+// bufferSize, since warmup is specific to a method and buffer size.
+// Models are keyed by serial number, which isn't reused like addresses
+class BackendPool {
+public:
+  ~BackendPool();
+
+  // load and warm up instances until there are count idle ones. Returns
+  // false on errors. On the loader, ordered with the model's loads and
+  // unloads, or on the NRT thread of non-real-time servers
+  bool fill(const NNModelDesc* modelDesc, const NNModelMethod* modelMethod,
+            int bufferSize, int count, int warmup);
+  // drop all instances of a model, e.g. when it's unloaded
+  void clear(const NNModelDesc* modelDesc);
+
+  // audio thread: get an idle instance, or nullptr. Doesn't wait for lock
+  Backend* checkout(const NNModelDesc* modelDesc,
+                    const NNModelMethod* modelMethod, int bufferSize);
+  // reset instance state and make it available again. Instances that
+  // didn't come from the pool, or whose model was cleared, are deleted
+  void checkin(const NNModelDesc* modelDesc, const NNModelMethod* modelMethod,
+               int bufferSize, Backend* backend);
+
+private:
+  using Key = std::tuple<uint64_t, const NNModelMethod*, int>;
+
+  std::map<Key, std::vector<Backend*>> m_idle;
+  std::mutex m_mutex;
+};
+
+} // namespace NN
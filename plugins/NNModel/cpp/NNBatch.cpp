@@ -0,0 +1,195 @@
+// NNBatch.cpp
+#include "NNBatch.hpp"
+#include "NNUGens.hpp"
+#include "SC_InterfaceTable.h"
+#include "SC_InlineBinaryOp.h"
+#include "SC_World.h"
+#include <bit>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+
+extern InterfaceTable* ft;
+
+namespace NN {
+
+// schedulers by (model, method, bufferSize)
+static std::map<std::tuple<const NNModelDesc*, const NNModelMethod*, int>,
+                BatchScheduler*> gSchedulers;
+// guards gSchedulers and members' join/leave
+static std::mutex gSchedulersMutex;
+
+BatchScheduler::BatchScheduler(World* world, const NNModelDesc* modelDesc,
+                               const NNModelMethod* modelMethod,
+                               int bufferSize, int debug):
+  mWorld(world), m_key(modelDesc, modelMethod, bufferSize),
+  m_modelDesc(modelDesc), m_method(modelMethod),
+  m_bufferSize(bufferSize), m_debug(debug) {
+  m_modelDesc->retain();
+}
+
+BatchScheduler::~BatchScheduler() {
+  m_modelDesc->release();
+}
+
+BatchScheduler* BatchScheduler::join(NN* nn, int warmup, int& slot) {
+  Key key(nn->m_modelDesc, nn->m_method, nn->m_bufferSize);
+  std::lock_guard<std::mutex> lock(gSchedulersMutex);
+
+  BatchScheduler* sched;
+  auto found = gSchedulers.find(key);
+  if (found == gSchedulers.end()) {
+    sched = new BatchScheduler(nn->mWorld, nn->m_modelDesc, nn->m_method,
+                               nn->m_bufferSize, nn->m_debug);
+    gSchedulers[key] = sched;
+    std::thread(loop, sched, warmup).detach();
+  } else {
+    sched = found->second;
+  }
+
+  slot = sched->addMember(nn);
+  if (slot < 0) {
+    Print("NNUGen: batch for %s is full (%d), using a separate thread\n",
+          nn->m_method->name.c_str(), maxBatchSize);
+    return nullptr;
+  }
+  return sched;
+}
+
+int BatchScheduler::addMember(NN* nn) {
+  uint64_t active = m_activeMask.load();
+  for (int slot = 0; slot < maxBatchSize; ++slot) {
+    auto& member = m_members[slot];
+    if ((active >> slot) & 1 || member.orphan.load() != nullptr) continue;
+    member.nn = nn;
+    member.busy = false;
+    m_activeMask |= uint64_t(1) << slot;
+    return slot;
+  }
+  return -1;
+}
+
+void BatchScheduler::leave(int slot) {
+  std::lock_guard<std::mutex> lock(gSchedulersMutex);
+  auto& member = m_members[slot];
+  m_activeMask &= ~(uint64_t(1) << slot);
+  member.orphan = member.nn;
+  // if the worker is still using this member's buffers, it will free them
+  if (!member.busy) reclaim(slot);
+}
+
+void BatchScheduler::reclaim(int slot) {
+  if (NN* nn = m_members[slot].orphan.exchange(nullptr))
+    model_perform_cleanup(nn);
+}
+
+void BatchScheduler::submit(int slot) {
+  m_members[slot].busy = true;
+  m_pending |= uint64_t(1) << slot;
+  m_data_available_lock.release();
+}
+
+// stop when there are no members left. Checked under lock, so that a new
+// member can't join a scheduler that is about to be deleted
+bool BatchScheduler::shouldStop() {
+  std::lock_guard<std::mutex> lock(gSchedulersMutex);
+  if (m_activeMask.load() != 0 || m_pending.load() != 0) return false;
+  for (int slot = 0; slot < maxBatchSize; ++slot) reclaim(slot);
+  gSchedulers.erase(m_key);
+  return true;
+}
+
+void BatchScheduler::load(int warmup) {
+  auto path = m_modelDesc->getPath();
+  if (m_debug >= Debug::all)
+    Print("NNUGen: loading batched model %s\n", path);
+  auto shared = m_modelDesc->getBackend();
+  if (shared ? m_model.load(*shared) : m_model.load(path)) {
+    Print("NNUGen: ERROR loading model %s\n", path);
+    return;
+  }
+
+  m_model.set_num_threads(m_modelDesc->getThreads(m_method));
+  auto& block = reserve(1);
+  for (int i = 0; i < warmup; ++i)
+    m_model.perform(block);
+
+  m_loaded = true;
+  if (m_debug >= Debug::all)
+    Print("NNUGen: loaded batched model %s\n", path);
+}
+
+// staging buffers only grow, so that steady state doesn't allocate
+PerformBlock& BatchScheduler::reserve(int n_batches) {
+  if (n_batches >= m_blocks.size()) {
+    int capacity = NEXTPOWEROFTWO(n_batches);
+    m_inBatch.assign(capacity * m_method->inSize(m_bufferSize), 0);
+    m_outBatch.assign(capacity * m_method->outSize(m_bufferSize), 0);
+    // rebind all blocks to the new buffers
+    m_blocks.assign(capacity + 1, PerformBlock());
+  }
+  auto& block = m_blocks[n_batches];
+  if (!block.is_bound())
+    m_model.bind(block, m_method->name,
+                 m_inBatch.data(), m_outBatch.data(), m_bufferSize, n_batches,
+                 m_method->inDim, m_method->inRatio,
+                 m_method->outDim, m_method->outRatio);
+  return block;
+}
+
+void BatchScheduler::process(uint64_t pending) {
+  if (!pending) return;
+  // only pending blocks, packed: methods are stateless, so a member's
+  // row can change from one batch to the next
+  int slots[maxBatchSize];
+  int n_batches = 0;
+  for (int slot = 0; slot < maxBatchSize; ++slot)
+    if ((pending >> slot) & 1) slots[n_batches++] = slot;
+  auto& block = reserve(n_batches);
+  size_t inSize = m_method->inSize(m_bufferSize);
+  size_t outSize = m_method->outSize(m_bufferSize);
+
+  auto start = StatsClock::now();
+  for (int b(0); b < n_batches; ++b) {
+    NN* nn = m_members[slots[b]].nn;
+    nn->m_stats->queueWait.record(start - nn->m_submitTimes[0]);
+    // members have no attributes: NNUGen doesn't batch UGens with any
+    memcpy(&m_inBatch[b * inSize], nn->m_inModel, inSize * sizeof(float));
+  }
+
+  auto performStart = StatsClock::now();
+  m_model.perform(block);
+  auto performDuration = StatsClock::now() - performStart;
+
+  for (int b(0); b < n_batches; ++b) {
+    auto& member = m_members[slots[b]];
+    // each member waited for the whole batch
+    member.nn->m_stats->inference.record(performDuration);
+    memcpy(member.nn->m_outModel, &m_outBatch[b * outSize],
+           outSize * sizeof(float));
+    member.busy = false;
+    reclaim(slots[b]);
+  }
+}
+
+void BatchScheduler::loop(BatchScheduler* sched, int warmup) {
+  sched->load(warmup);
+  // members are phase-aligned, so they all submit during the same server
+  // block: wait at most one block for the others to join the batch
+  auto blockDuration = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::duration<double>(sched->mWorld->mFullRate.mBufDuration));
+  while (!sched->shouldStop()) {
+    if (!sched->m_data_available_lock.try_acquire_for(
+      std::chrono::milliseconds(200)))
+      continue;
+    auto deadline = std::chrono::steady_clock::now() + blockDuration;
+    while (std::popcount(sched->m_pending.load()) <
+             std::popcount(sched->m_activeMask.load()) &&
+           sched->m_data_available_lock.try_acquire_until(deadline)) {}
+    sched->process(sched->m_pending.exchange(0));
+  }
+  delete sched;
+}
+
+} // namespace NN
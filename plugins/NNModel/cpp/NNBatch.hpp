@@ -0,0 +1,76 @@
+// NNBatch.hpp
+
+#pragma once
+#include "NNModel.hpp"
+#include "backend/backend.h"
+#include <atomic>
+#include <cstdint>
+#include <semaphore>
+#include <tuple>
+#include <vector>
+
+struct World;
+
+namespace NN {
+
+class NN;
+
+// collects blocks from all NN instances bound to the same model, method and
+// buffer size, and processes them in a single batched forward pass.
+// Only stateless methods are batched: pending blocks are packed in the
+// batch whatever their member's slot, like on nn_daemon.
+class BatchScheduler {
+public:
+  static constexpr int maxBatchSize = 64;
+
+  // find or create the scheduler for this model/method/bufferSize
+  // and join it. Returns nullptr if the batch is full.
+  static BatchScheduler* join(NN* nn, int warmup, int& slot);
+  // leave the batch: NN resources are freed here or by the worker
+  // as soon as it's done with this member's buffers
+  void leave(int slot);
+
+  // called in audio thread
+  bool isLoaded() const { return m_loaded; }
+  bool ready(int slot) const { return !m_members[slot].busy.load(); }
+  void submit(int slot);
+
+private:
+  using Key = std::tuple<const NNModelDesc*, const NNModelMethod*, int>;
+
+  struct Member {
+    NN* nn = nullptr;
+    std::atomic<bool> busy{false};
+    std::atomic<NN*> orphan{nullptr};
+  };
+
+  BatchScheduler(World* world, const NNModelDesc* modelDesc,
+                 const NNModelMethod* modelMethod, int bufferSize, int debug);
+  ~BatchScheduler();
+
+  int addMember(NN* nn);
+  static void loop(BatchScheduler* sched, int warmup);
+  void load(int warmup);
+  PerformBlock& reserve(int n_batches);
+  void process(uint64_t pending);
+  void reclaim(int slot);
+  bool shouldStop();
+
+  World* mWorld;
+  Key m_key;
+  const NNModelDesc* m_modelDesc;
+  const NNModelMethod* m_method;
+  int m_bufferSize, m_debug;
+  Backend m_model;
+  Member m_members[maxBatchSize];
+  std::atomic<uint64_t> m_activeMask{0};
+  std::atomic<uint64_t> m_pending{0};
+  std::counting_semaphore<> m_data_available_lock{0};
+  std::atomic<bool> m_loaded{false};
+  // planar [n_batches, dim, bufferSize] staging blocks, grown as members
+  // join, and their bindings for each batch size
+  std::vector<float> m_inBatch, m_outBatch;
+  std::vector<PerformBlock> m_blocks;
+};
+
+} // namespace NN
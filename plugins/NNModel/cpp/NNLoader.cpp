@@ -0,0 +1,69 @@
+// NNLoader.cpp
+#include "NNLoader.hpp"
+#include <algorithm>
+
+namespace NN {
+
+void ModelLoader::start() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_threads.empty()) return;
+  int numThreads = m_numThreads;
+  if (numThreads <= 0)
+    numThreads = std::max(2u, std::thread::hardware_concurrency() / 4);
+  for (int i = 0; i < numThreads; ++i)
+    m_threads.emplace_back(loop, this);
+}
+
+ModelLoader::~ModelLoader() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+  }
+  m_cond.notify_all();
+  for (auto& thread: m_threads) thread.join();
+}
+
+void ModelLoader::submit(int key, Job job) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks.push_back({key, job});
+  }
+  m_cond.notify_one();
+}
+
+bool ModelLoader::take(Task& task) {
+  for (auto it = m_tasks.begin(); it != m_tasks.end(); ++it) {
+    if (it->key >= 0 &&
+        std::find(m_busyKeys.begin(), m_busyKeys.end(), it->key) != m_busyKeys.end())
+      continue;
+    task = *it;
+    m_tasks.erase(it);
+    if (task.key >= 0) m_busyKeys.push_back(task.key);
+    return true;
+  }
+  return false;
+}
+
+void ModelLoader::loop(ModelLoader* loader) {
+  std::unique_lock<std::mutex> lock(loader->m_mutex);
+  while (true) {
+    Task task;
+    bool taken = false;
+    loader->m_cond.wait(lock, [&]() {
+      return !loader->m_running || (taken = loader->take(task));
+    });
+    if (!taken) return;
+
+    lock.unlock();
+    task.job.fn(task.job.data);
+    lock.lock();
+
+    if (task.key < 0) continue;
+    auto& busy = loader->m_busyKeys;
+    busy.erase(std::find(busy.begin(), busy.end(), task.key));
+    // tasks waiting for this key can run now
+    loader->m_cond.notify_all();
+  }
+}
+
+} // namespace NN
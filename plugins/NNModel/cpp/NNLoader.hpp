@@ -0,0 +1,50 @@
+// NNLoader.hpp
+
+#pragma once
+#include "NNWorkerPool.hpp"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace NN {
+
+// plugin-owned threads loading and unloading models, so that the server's
+// NRT thread stays free for other commands. Tasks for the same model id run
+// in the order they were submitted, tasks for different ids in parallel.
+// Threads are only started by start, on real-time servers
+class ModelLoader {
+public:
+  // 0: a few threads, depending on cores
+  explicit ModelLoader(int numThreads = 0): m_numThreads(numThreads) {}
+  ~ModelLoader();
+
+  // start loader threads, if not started yet
+  void start();
+
+  // key: model id, -1 for tasks that don't need ordering.
+  // Not RT-safe: called from the NRT thread
+  void submit(int key, Job job);
+
+private:
+  struct Task {
+    int key;
+    Job job;
+  };
+
+  static void loop(ModelLoader* loader);
+  // first queued task whose key isn't being processed, under lock
+  bool take(Task& task);
+
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+  std::deque<Task> m_tasks;
+  // keys of running tasks
+  std::vector<int> m_busyKeys;
+  std::vector<std::thread> m_threads;
+  int m_numThreads;
+  bool m_running = true;
+};
+
+} // namespace NN
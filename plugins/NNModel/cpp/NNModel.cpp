@@ -1,30 +1,142 @@
 #include "NNModel.hpp"
+#include "NNOffline.hpp"
 #include "backend/backend.h"
+#include <torch/version.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <thread>
 #include <ostream>
+#include <random>
 #include "SC_InterfaceTable.h"
 
 extern InterfaceTable* ft;
 
 namespace NN {
 
-NNModelDesc::NNModelDesc(unsigned short id): m_idx(id) {}
+static std::atomic<uint64_t> s_nextSerial{0};
 
-bool NNModelDesc::load(const char* path) {
+NNModelDesc::NNModelDesc(unsigned short id, NNModelDescLib* lib):
+  m_idx(id), m_serial(s_nextSerial++), m_lib(lib) {}
+
+void NNModelDesc::release() const {
+  // this may be freed as soon as its count drops: not read after that
+  auto lib = m_lib;
+  if (m_refs.fetch_sub(1) == 1 && lib) lib->onUnused();
+}
+
+const char* precisionName(NNPrecision precision) {
+  switch (precision) {
+    case precisionBf16: return "bf16";
+    case precisionFp16: return "fp16";
+    default: return "fp32";
+  }
+}
+
+static c10::ScalarType precisionType(NNPrecision precision) {
+  switch (precision) {
+    case precisionBf16: return torch::kBFloat16;
+    case precisionFp16: return torch::kFloat16;
+    default: return torch::kFloat;
+  }
+}
+
+bool NNModelDesc::load(const char* path, const NNLoadOptions& options) {
   Print("NNModelDesc: loading %s\n", path);
-  Backend backend;
-  bool loaded = backend.load(path) == 0;
-  if (loaded) {
-    Print("NNModelDesc: loaded %s\n", path);
+  auto backend = std::make_shared<Backend>();
+  m_threads = options.threads;
+  backend->set_num_threads(m_threads);
+
+  // remote models are only read for their info: optimizations are up to the
+  // daemon, and their weights aren't kept
+  if (options.remote != nullptr && strlen(options.remote) > 0) {
+    if (backend->load(path) != 0) {
+      Print("ERROR: NNModelDesc can't load model %s\n", path);
+      return false;
+    }
+    readInfo(*backend);
+    m_path = path;
+    m_remote = options.remote;
+    m_loaded = true;
+    Print("NNModelDesc: %s runs on nn_daemon %s\n", path, options.remote);
+    return true;
+  }
+
+  std::string cacheEntry;
+  if (options.cacheDir != nullptr && strlen(options.cacheDir) > 0)
+    cacheEntry = getCacheEntry(options.cacheDir, path, options);
+
+  if (!cacheEntry.empty() && readCache(cacheEntry, *backend)) {
+    Print("NNModelDesc: loaded %s from cache\n", path);
   } else {
-    Print("ERROR: NNModelDesc can't load model %s\n", path);
-    return false;
+    bool loaded = backend->load(path) == 0;
+    if (loaded) {
+      Print("NNModelDesc: loaded %s\n", path);
+    } else {
+      Print("ERROR: NNModelDesc can't load model %s\n", path);
+      return false;
+    }
+    readInfo(*backend);
+    bool quantize = options.quantized != nullptr && strlen(options.quantized) > 0;
+    m_quantized = quantize && this->quantize(backend, options.quantized);
+    if (quantize && !m_quantized)
+      Print("NNModelDesc: couldn't use quantized %s, using fp32 model\n", options.quantized);
+    // weights must be converted before being frozen into constants
+    m_precision = precisionFp32;
+    if (options.precision != precisionFp32) {
+      if (m_quantized)
+        Print("NNModelDesc: quantized models run in fp32\n");
+      else if (backend->set_precision(precisionType(options.precision)))
+        m_precision = options.precision;
+      else
+        Print("NNModelDesc: %s not supported on this device, using fp32\n",
+              precisionName(options.precision));
+    }
+    m_frozen = options.freeze && freeze(*backend);
+    if (options.freeze && !m_frozen)
+      Print("NNModelDesc: couldn't freeze %s, using it unfrozen\n", path);
+    if (!cacheEntry.empty()) writeCache(cacheEntry, *backend);
   }
 
   // cache path
   m_path = path;
 
+  probeStateless(*backend);
+  if (options.autotune) autotune(*backend, options.sampleRate);
+
+  // keep loaded model, to share its weights with UGens
+  std::unique_lock<std::mutex> lock(m_backendMutex);
+  m_backend = backend;
+  lock.unlock();
+
+  m_loaded = true;
+  return true;
+}
+
+// average duration of a processing pass, after one warmup pass
+static double timeBlock(Backend& backend, PerformBlock& block, int numPasses) {
+  backend.perform(block);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < numPasses; ++i) backend.perform(block);
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count() / numPasses;
+}
+
+// same probe as offline processing and nn_daemon: a batch of two gives the
+// same output as one block twice
+void NNModelDesc::probeStateless(Backend& backend) {
+  for (auto& method: m_methods) {
+    OfflineProcessor probe(backend, method, m_higherRatio, 2);
+    method.stateless = probe.prepare() && probe.batchSize() > 1;
+  }
+}
+
+void NNModelDesc::readInfo(Backend& backend) {
   m_higherRatio = backend.get_higher_ratio();
 
   // cache methods
@@ -52,11 +164,346 @@ bool NNModelDesc::load(const char* path) {
       Print("NNModelDesc: couldn't read attribute '%s'\n", name.c_str());
     } 
   }
+}
 
-  m_loaded = true;
+bool NNModelDesc::freeze(Backend& backend) {
+  auto unfrozenMs = timeMethods(backend);
+  if (!backend.optimize()) return false;
+  auto frozenMs = timeMethods(backend);
+  for (int i = 0; i < m_methods.size(); ++i) {
+    m_methods[i].unfrozenBlockMs = unfrozenMs[i];
+    m_methods[i].frozenBlockMs = frozenMs[i];
+    Print("NNModelDesc: frozen %s: %.3fms -> %.3fms per block\n",
+          m_methods[i].name.c_str(), unfrozenMs[i], frozenMs[i]);
+  }
+  return true;
+}
+
+// add the squared values of a block, and of its difference from another
+static void blockEnergy(const std::vector<float>& ref, const std::vector<float>& other,
+                        double& refEnergy, double& errEnergy) {
+  for (size_t i = 0; i < ref.size(); ++i) {
+    double err = ref[i] - other[i];
+    refEnergy += ref[i] * ref[i];
+    errEnergy += err * err;
+  }
+}
+
+bool NNModelDesc::quantize(std::shared_ptr<Backend>& backend, const char* quantizedPath) {
+  const int numPasses = 4;
+  // a first block can be silent, or unlike later ones (e.g. filters warming up)
+  const int numComparePasses = 4;
+  auto quantized = std::make_shared<Backend>();
+  quantized->set_num_threads(m_threads);
+  if (quantized->load(quantizedPath) != 0) return false;
+
+  // the quantized variant must be a drop-in replacement
+  for (const auto& method: m_methods) {
+    std::vector<int> params = {method.inDim, method.inRatio, method.outDim, method.outRatio};
+    if (quantized->get_method_params(method.name) != params) {
+      Print("NNModelDesc: quantized model method %s doesn't match\n", method.name.c_str());
+      return false;
+    }
+  }
+
+  // comparison passes shouldn't leave any trace in model states
+  backend->save_state();
+  quantized->save_state();
+  std::minstd_rand rand(m_idx);
+  std::uniform_real_distribution<float> noise(-1, 1);
+  for (auto& method: m_methods) {
+    int bufferSize = m_higherRatio;
+    std::vector<float> inModel(method.inSize(bufferSize));
+    std::vector<float> outFp32(method.outSize(bufferSize), 0);
+    std::vector<float> outQuantized(method.outSize(bufferSize), 0);
+    PerformBlock fp32Block, quantizedBlock;
+    if (!backend->bind(fp32Block, method.name, inModel.data(), outFp32.data(),
+                       bufferSize, 1, method.inDim, method.inRatio,
+                       method.outDim, method.outRatio) ||
+        !quantized->bind(quantizedBlock, method.name, inModel.data(), outQuantized.data(),
+                         bufferSize, 1, method.inDim, method.inRatio,
+                         method.outDim, method.outRatio))
+      continue;
+
+    // compare first passes from the same initial state
+    double refEnergy = 0, errEnergy = 0;
+    for (int i = 0; i < numComparePasses; ++i) {
+      std::generate(inModel.begin(), inModel.end(), [&]() { return noise(rand); });
+      backend->perform(fp32Block);
+      quantized->perform(quantizedBlock);
+      blockEnergy(outFp32, outQuantized, refEnergy, errEnergy);
+    }
+    double numValues = static_cast<double>(outFp32.size()) * numComparePasses;
+    method.fp32Rms = std::sqrt(refEnergy / numValues);
+    method.quantizedRmsError = std::sqrt(errEnergy / numValues);
+    // no signal to compare the error to: only the RMS error is reported
+    if (refEnergy > 0)
+      method.quantizedSnr = errEnergy > 0 ? 10 * std::log10(refEnergy / errEnergy) : 999;
+    method.fp32BlockMs = timeBlock(*backend, fp32Block, numPasses);
+    method.quantizedBlockMs = timeBlock(*quantized, quantizedBlock, numPasses);
+    if (refEnergy > 0)
+      Print("NNModelDesc: quantized %s: %.3fms -> %.3fms per block, SNR %.1fdB\n",
+            method.name.c_str(), method.fp32BlockMs, method.quantizedBlockMs,
+            method.quantizedSnr);
+    else
+      Print("NNModelDesc: quantized %s: %.3fms -> %.3fms per block, silent fp32 "
+            "output, RMS error %g\n", method.name.c_str(), method.fp32BlockMs,
+            method.quantizedBlockMs, method.quantizedRmsError);
+  }
+  backend->reset_state();
+  quantized->reset_state();
+
+  backend = quantized;
+  return true;
+}
+
+// FNV-1a, to name cache entries after the files they were made from
+static constexpr uint64_t hashSeed = 0xcbf29ce484222325;
+static uint64_t hashBytes(uint64_t hash, const char* data, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 0x100000001b3;
+  }
+  return hash;
+}
+
+static bool hashFile(uint64_t& hash, const char* path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open()) return false;
+  std::vector<char> chunk(1 << 16);
+  while (file.read(chunk.data(), chunk.size()) || file.gcount() > 0)
+    hash = hashBytes(hash, chunk.data(), file.gcount());
   return true;
 }
 
+// size and modification time: files are only hashed again when they change
+static std::string fileStamp(const char* path) {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  auto size = fs::file_size(path, ec);
+  if (ec) return "";
+  auto mtime = fs::last_write_time(path, ec);
+  if (ec) return "";
+  return std::to_string(size) + " "
+    + std::to_string(mtime.time_since_epoch().count());
+}
+
+// entries are named <path hash>_<variant>_<content hash>: when a model file
+// changes, it gets a new entry, and the stale one of the same variant is
+// removed. Content hashes are kept in <path hash>_<variant>.stamp, with the
+// stamps of the files they were computed from
+std::string NNModelDesc::getCacheEntry(const char* cacheDir, const char* path,
+                                       const NNLoadOptions& options) {
+  namespace fs = std::filesystem;
+  std::string stamp = fileStamp(path);
+  if (stamp.empty()) return "";
+  // artifacts also depend on load options and torch version
+  std::string variant = std::string(options.freeze ? "frozen-" : "")
+    + precisionName(options.precision) + "-" + TORCH_VERSION;
+  bool quantized = options.quantized != nullptr && strlen(options.quantized) > 0;
+  if (quantized) {
+    stamp += " " + fileStamp(options.quantized);
+    variant += "-quantized";
+  }
+  uint64_t pathHash = hashBytes(hashSeed, path, strlen(path));
+  char pathName[20];
+  snprintf(pathName, sizeof(pathName), "%016llx", (unsigned long long) pathHash);
+  std::string prefix = std::string(pathName) + "_" + variant;
+
+  std::error_code ec;
+  fs::create_directories(cacheDir, ec);
+  if (ec) {
+    Print("NNModelDesc: can't create cache directory %s\n", cacheDir);
+    return "";
+  }
+  auto stampPath = fs::path(cacheDir) / (prefix + ".stamp");
+  std::string contentName, storedStamp;
+  std::ifstream stampFile(stampPath);
+  if (std::getline(stampFile, storedStamp) && storedStamp == stamp)
+    std::getline(stampFile, contentName);
+  stampFile.close();
+
+  if (contentName.empty()) {
+    uint64_t contentHash = hashSeed;
+    if (!hashFile(contentHash, path)) return "";
+    if (quantized) hashFile(contentHash, options.quantized);
+    char hashName[20];
+    snprintf(hashName, sizeof(hashName), "%016llx", (unsigned long long) contentHash);
+    contentName = hashName;
+    auto tmpPath = stampPath;
+    tmpPath += ".tmp";
+    std::ofstream(tmpPath) << stamp << "\n" << contentName << "\n";
+    fs::rename(tmpPath, stampPath, ec);
+  }
+
+  prefix += "_";
+  std::string name = prefix + contentName;
+  for (const auto& entry: fs::directory_iterator(cacheDir, ec)) {
+    auto filename = entry.path().filename().string();
+    if (filename.rfind(prefix, 0) == 0 && filename.rfind(name, 0) != 0)
+      fs::remove(entry.path(), ec);
+  }
+  return (fs::path(cacheDir) / name).string();
+}
+
+static constexpr int cacheVersion = 4;
+
+// sidecar: the info that would otherwise be read from the model
+bool NNModelDesc::readCache(const std::string& entry, Backend& backend) {
+  std::ifstream info(entry + ".info");
+  if (!info.is_open()) return false;
+
+  std::string key;
+  int version = 0, numMethods = 0, numAttributes = 0, higherRatio = 0;
+  bool frozen = false, quantized = false;
+  int precision = precisionFp32;
+  info >> key >> version;
+  if (key != "nn-cache" || version != cacheVersion) return false;
+  info >> key >> frozen >> key >> quantized >> key >> precision
+    >> key >> higherRatio >> key >> numMethods;
+  std::vector<NNModelMethod> methods;
+  for (int i = 0; i < numMethods && info; ++i) {
+    std::string name;
+    std::vector<int> params(4);
+    info >> name >> params[0] >> params[1] >> params[2] >> params[3];
+    NNModelMethod method(name, params);
+    info >> method.unfrozenBlockMs >> method.frozenBlockMs
+      >> method.fp32BlockMs >> method.quantizedBlockMs >> method.quantizedSnr
+      >> method.fp32Rms >> method.quantizedRmsError;
+    methods.push_back(method);
+  }
+  info >> key >> numAttributes;
+  std::vector<NNModelAttribute> attributes;
+  for (int i = 0; i < numAttributes && info; ++i) {
+    int type;
+    std::string name;
+    info >> type >> name;
+    attributes.push_back({static_cast<NNAttributeType>(type), name});
+  }
+  // reduced precision weights are already converted, this only checks support
+  if (info.fail() || backend.load(entry + ".ts") != 0 ||
+      !backend.set_precision(precisionType(static_cast<NNPrecision>(precision)))) {
+    Print("NNModelDesc: invalid cache entry %s\n", entry.c_str());
+    return false;
+  }
+
+  m_methods = methods;
+  m_attributes = attributes;
+  m_higherRatio = higherRatio;
+  m_frozen = frozen;
+  m_quantized = quantized;
+  m_precision = static_cast<NNPrecision>(precision);
+  return true;
+}
+
+// written to temporary files and renamed, so that a load never finds a
+// partial entry. The sidecar is renamed last
+void NNModelDesc::writeCache(const std::string& entry, Backend& backend) const {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  if (!backend.save(entry + ".ts.tmp")) {
+    Print("NNModelDesc: couldn't write cache entry %s\n", entry.c_str());
+    return;
+  }
+  fs::rename(entry + ".ts.tmp", entry + ".ts", ec);
+
+  std::ofstream info(entry + ".info.tmp");
+  info << "nn-cache " << cacheVersion
+    << "\nfrozen " << m_frozen
+    << "\nquantized " << m_quantized
+    << "\nprecision " << m_precision
+    << "\nhigherRatio " << m_higherRatio
+    << "\nmethods " << m_methods.size();
+  for (const auto& m: m_methods)
+    info << "\n" << m.name << " " << m.inDim << " " << m.inRatio
+      << " " << m.outDim << " " << m.outRatio
+      << " " << m.unfrozenBlockMs << " " << m.frozenBlockMs
+      << " " << m.fp32BlockMs << " " << m.quantizedBlockMs << " " << m.quantizedSnr
+      << " " << m.fp32Rms << " " << m.quantizedRmsError;
+  info << "\nattributes " << m_attributes.size();
+  for (const auto& attr: m_attributes)
+    info << "\n" << attr.type << " " << attr.name;
+  info << "\n";
+  info.close();
+  if (info.fail() || ec) {
+    Print("NNModelDesc: couldn't write cache entry %s\n", entry.c_str());
+    return;
+  }
+  fs::rename(entry + ".info.tmp", entry + ".info", ec);
+}
+
+std::shared_ptr<Backend> NNModelDesc::getBackend() const {
+  std::unique_lock<std::mutex> lock(m_backendMutex);
+  return m_backend;
+}
+
+int NNModelDesc::getThreads(const NNModelMethod* method) const {
+  return method->tunedThreads > 0 ? method->tunedThreads : m_threads;
+}
+
+std::vector<float> NNModelDesc::timeMethods(Backend& backend) const {
+  const int numPasses = 4;
+  std::vector<float> times;
+  // timing passes shouldn't leave any trace in the shared model state
+  backend.save_state();
+  for (const auto& method: m_methods) {
+    int bufferSize = m_higherRatio;
+    std::vector<float> inModel(method.inSize(bufferSize), 0);
+    std::vector<float> outModel(method.outSize(bufferSize), 0);
+    PerformBlock block;
+    bool bound = backend.bind(block, method.name, inModel.data(), outModel.data(),
+                              bufferSize, 1, method.inDim, method.inRatio,
+                              method.outDim, method.outRatio);
+    times.push_back(bound ? timeBlock(backend, block, numPasses) : 0);
+  }
+  backend.reset_state();
+  return times;
+}
+
+// time each method at a few buffer sizes and thread counts. For each method
+// choose the smallest buffer size that runs well within its real-time budget,
+// with its fastest thread count
+void NNModelDesc::autotune(Backend& backend, double sampleRate) {
+  const int numPasses = 4;
+  // without per-instance threads, only the default count can be timed
+  int maxThreads = Backend::has_per_instance_threads()
+    ? std::max<int>(1, std::thread::hardware_concurrency() - 1) : 0;
+  // tuning passes shouldn't leave any trace in the shared model state
+  backend.save_state();
+
+  for (auto& method: m_methods) {
+    Print("NNModelDesc: tuning %s\n", method.name.c_str());
+    for (int bufferSize = m_higherRatio; bufferSize <= m_higherRatio * 4; bufferSize *= 2) {
+      std::vector<float> inModel(method.inSize(bufferSize), 0);
+      std::vector<float> outModel(method.outSize(bufferSize), 0);
+      PerformBlock block;
+      if (!backend.bind(block, method.name, inModel.data(), outModel.data(),
+                        bufferSize, 1, method.inDim, method.inRatio,
+                        method.outDim, method.outRatio))
+        break;
+
+      int bestThreads = 0;
+      double bestMs = -1;
+      // 1, 2, 4... threads, or only the default (0)
+      for (int threads = std::min(1, maxThreads); threads <= maxThreads; threads = threads * 2 + !threads) {
+        backend.set_num_threads(threads);
+        double ms = timeBlock(backend, block, numPasses);
+        if (bestMs < 0 || ms < bestMs) { bestThreads = threads; bestMs = ms; }
+      }
+
+      method.tunedThreads = bestThreads;
+      method.tunedBufferSize = bufferSize;
+      method.tunedBlockMs = bestMs;
+      // half of the block duration leaves room for jitter and other models
+      double budgetMs = 500. * bufferSize / sampleRate;
+      if (bestMs < budgetMs) break;
+    }
+  }
+
+  backend.set_num_threads(m_threads);
+  backend.reset_state();
+}
+
 const NNModelMethod* NNModelDesc::getMethod(unsigned short idx, bool warn) const {
   try {
     return &m_methods.at(idx);
@@ -75,48 +522,92 @@ const NNModelAttribute* NNModelDesc::getAttribute(unsigned short idx, bool warn)
   }
 }
 
-NNModelMethod::NNModelMethod(const std::string& name, const std::vector<int>& params):
-name(name) {
-  inDim = params[0];
-  inRatio = params[1];
-  outDim = params[2];
-  outRatio = params[3];
-}
+NNModelDescLib::NNModelDescLib(void (*requestCollect)()):
+  m_current(new Snapshot()), m_requestCollect(requestCollect), m_nextId(0) {}
 
-NNModelDescLib::NNModelDescLib(): models(), modelCount(0) {}
+NNModelDescLib::~NNModelDescLib() {
+  // plugin unload: no UGens are left
+  auto current = m_current.load();
+  for (auto model: *current) delete model;
+  delete current;
+  for (auto snapshot: m_retiredSnapshots) delete snapshot;
+  for (auto model: m_retiredModels) delete model;
+}
 
 unsigned short NNModelDescLib::getNextId() {
-  unsigned short id = modelCount;
-  while(models[id] != nullptr) id++;
+  const auto& models = *m_current.load();
+  unsigned short id = m_nextId;
+  while (id < models.size() && models[id] != nullptr) id++;
   return id;
 };
 
-NNModelDesc* NNModelDescLib::get(unsigned short id, bool warn) const {
-  NNModelDesc* model;
-  bool found = false;
-  try {
-    model = models.at(id);
-    found = model != nullptr;
-  } catch(...) {
-    if (warn) {
-      Print("NNModelDescLib: id %d not found. Loaded models:%s\n", id, models.size() ? "" : " []");
-      for (auto kv: models) {
-        Print("id: %d -> %s\n", kv.first, kv.second->getPath());
+void NNModelDescLib::publish(unsigned short id, NNModelDesc* model) {
+  auto current = m_current.load();
+  auto next = new Snapshot(*current);
+  if (next->size() <= id) next->resize(id + 1, nullptr);
+  if (auto replaced = (*next)[id]) m_retiredModels.push_back(replaced);
+  (*next)[id] = model;
+  m_current.store(next);
+  m_retiredSnapshots.push_back(current);
+  m_numRetired.store(m_retiredModels.size());
+  collect();
+}
+
+void NNModelDescLib::collect() {
+  // readers that started before publishing may still be using retired
+  // snapshots, or be about to retain a retired model: try again next time
+  if (m_readers.load() != 0) return;
+  for (auto snapshot: m_retiredSnapshots) delete snapshot;
+  m_retiredSnapshots.clear();
+  auto unused = std::partition(m_retiredModels.begin(), m_retiredModels.end(),
+                               [](NNModelDesc* model) { return model->refs() > 0; });
+  for (auto it = unused; it != m_retiredModels.end(); ++it) delete *it;
+  m_retiredModels.erase(unused, m_retiredModels.end());
+  m_numRetired.store(m_retiredModels.size());
+}
+
+// publish counts retired models before collect reads their references,
+// releases the other way round: a model released while being retired is
+// seen by at least one of them
+void NNModelDescLib::onUnused() const {
+  if (m_numRetired.load() > 0 && m_requestCollect) m_requestCollect();
+}
+
+void NNModelDescLib::collectRetired() {
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  // reads are short: wait for them, rather than leaving models to the
+  // next writer
+  while (m_readers.load() != 0) std::this_thread::yield();
+  collect();
+}
+
+NNModelRef NNModelDescLib::get(unsigned short id, bool warn) const {
+  NNModelDesc* model = nullptr;
+  {
+    ReadSection section(*this);
+    const auto& models = section.snapshot();
+    if (id < models.size()) model = models[id];
+    if (model) {
+      model->retain();
+    } else if (warn) {
+      Print("NNModelDescLib: id %d not found. Loaded models:\n", id);
+      for (size_t i = 0; i < models.size(); ++i) {
+        if (models[i]) Print("id: %d -> %s\n", static_cast<int>(i), models[i]->getPath());
       }
-    };
-    found = false;
+    }
   }
 
-  if (!found) return nullptr;
+  if (!model) return NNModelRef();
   if (!model->is_loaded()) {
     if (warn) Print("NNModelDescLib: id %d not loaded yet\n", id);
   }
-  return model;
+  return NNModelRef(model);
 }
 
 void NNModelDescLib::streamAllInfo(std::ostream& dest) const{
-  for (const auto& kv: models) {
-    kv.second->streamInfo(dest);
+  ReadSection section(*this);
+  for (auto model: section.snapshot()) {
+    if (model) model->streamInfo(dest);
   }
 }
 
@@ -125,39 +616,43 @@ void NNModelDescLib::printAllInfo() const{
   std::cout << std::endl;
 }
 
-NNModelDesc* NNModelDescLib::load(const char* path) {
+NNModelRef NNModelDescLib::load(const char* path, const NNLoadOptions& options) {
+  std::unique_lock<std::mutex> lock(m_writeMutex);
   unsigned short id = getNextId();
-  return load(id, path);
+  // reserved, even while loading
+  m_nextId = id + 1;
+  lock.unlock();
+  auto model = load(id, path, options);
+  lock.lock();
+  if (!model && m_nextId == id + 1) m_nextId = id;
+  return model;
 }
-NNModelDesc* NNModelDescLib::load(unsigned short id, const char* path) {
-  auto model = get(id, false);
+
+NNModelRef NNModelDescLib::load(unsigned short id, const char* path, const NNLoadOptions& options) {
+  auto prevModel = get(id, false);
   /* Print("NNBackend: loading model %s at idx %d\n", path, id); */
-  if (model != nullptr) {
-    if (model->getPath() == path) {
-      Print("NNBackend: model %d already loaded %s\n", id, path);
-      return model;
-    } else {
-      return model->load(path) ? model : nullptr;
-    }
+  if (prevModel && prevModel->getPath() == path) {
+    Print("NNBackend: model %d already loaded %s\n", id, path);
+    return prevModel;
   }
 
-  model = new NNModelDesc(id);
-  if (model->load(path)) {
-    models[id] = model;
-    modelCount++;
-    return model;
-  } else {
+  // UGens running the previous model keep it until they're freed
+  auto model = new NNModelDesc(id, this);
+  if (!model->load(path, options)) {
     delete model;
-    return nullptr;
+    return NNModelRef();
   }
+  model->retain();
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  publish(id, model);
+  return NNModelRef(model);
 }
 
 void NNModelDescLib::unload(unsigned short id) {
-  auto model = get(id, true);
-  if (model == nullptr) return;
+  if (!get(id, true)) return;
   /* Print("NNBackend: unloading model %s at idx %d\n", model->m_path, id); */
-  models.erase(id);
-  delete model;
+  std::lock_guard<std::mutex> lock(m_writeMutex);
+  publish(id, nullptr);
 }
 
 bool NNModelDescLib::dumpAllInfo(const char* filename) const {
@@ -183,14 +678,43 @@ bool NNModelDescLib::dumpAllInfo(const char* filename) const {
 void NNModelDesc::streamInfo(std::ostream& stream) const {
   stream << "- idx: " << m_idx
     << "\n  modelPath: " << m_path.c_str()
-    << "\n  minBufferSize: " << m_higherRatio
-    << "\n  methods:";
+    << "\n  minBufferSize: " << m_higherRatio;
+  if (m_threads > 0)
+    stream << "\n  threads: " << m_threads;
+  if (m_frozen)
+    stream << "\n  frozen: true";
+  if (m_quantized)
+    stream << "\n  quantized: true";
+  if (m_precision != precisionFp32)
+    stream << "\n  precision: " << precisionName(m_precision);
+  stream << "\n  methods:";
   for (const auto& m: m_methods) {
     stream << "\n    - name: " << m.name
       << "\n      inDim: " << m.inDim
       << "\n      inRatio: " << m.inRatio
       << "\n      outDim: " << m.outDim
       << "\n      outRatio: " << m.outRatio;
+    // builds without per-instance threads only tune buffer sizes
+    if (m.tunedBufferSize > 0) {
+      stream << "\n      tuned:"
+        << "\n        threads: ";
+      if (m.tunedThreads > 0) stream << m.tunedThreads; else stream << "default";
+      stream << "\n        bufferSize: " << m.tunedBufferSize
+        << "\n        blockMs: " << m.tunedBlockMs;
+    }
+    if (m.frozenBlockMs > 0) {
+      stream << "\n      frozen:"
+        << "\n        blockMs: " << m.frozenBlockMs
+        << "\n        unfrozenBlockMs: " << m.unfrozenBlockMs;
+    }
+    if (m.quantizedBlockMs > 0) {
+      stream << "\n      quantized:"
+        << "\n        blockMs: " << m.quantizedBlockMs
+        << "\n        fp32BlockMs: " << m.fp32BlockMs
+        << "\n        rmsError: " << m.quantizedRmsError;
+      if (m.fp32Rms > 0)
+        stream << "\n        snrDb: " << m.quantizedSnr;
+    }
   }
   if (m_attributes.size() > 0) {
     stream << "\n  attributes:";
@@ -205,6 +729,39 @@ void NNModelDesc::printInfo() const {
   std::cout << std::endl;
 }
 
+static void encodeString(std::vector<float>& dest, const std::string& str) {
+  dest.push_back(str.size());
+  for (unsigned char c: str) dest.push_back(c);
+}
+
+void NNModelDesc::encodeInfo(std::vector<float>& dest) const {
+  dest.push_back(infoFormat);
+  dest.push_back(m_idx);
+  dest.push_back(m_higherRatio);
+  dest.push_back(m_threads);
+  dest.push_back((m_frozen ? 1 : 0) | (m_quantized ? 2 : 0));
+  dest.push_back(m_precision);
+  encodeString(dest, m_path);
+  dest.push_back(m_methods.size());
+  for (const auto& m: m_methods) {
+    encodeString(dest, m.name);
+    dest.insert(dest.end(), {
+      static_cast<float>(m.inDim), static_cast<float>(m.inRatio),
+      static_cast<float>(m.outDim), static_cast<float>(m.outRatio),
+      // measures, 0 when not taken
+      static_cast<float>(m.tunedThreads), static_cast<float>(m.tunedBufferSize),
+      m.tunedBlockMs, m.frozenBlockMs, m.unfrozenBlockMs,
+      m.quantizedBlockMs, m.fp32BlockMs, m.quantizedSnr,
+      m.fp32Rms, m.quantizedRmsError
+    });
+  }
+  dest.push_back(m_attributes.size());
+  for (const auto& attr: m_attributes) {
+    encodeString(dest, attr.name);
+    dest.push_back(attr.type);
+  }
+}
+
 bool NNModelDesc::dumpInfo(const char* filename) const {
   try {
     std::ofstream file;
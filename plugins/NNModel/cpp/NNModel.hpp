@@ -1,9 +1,17 @@
 // NNModel.hpp
 
 #pragma once
+#include <atomic>
+#include <cstdint>
 #include <ostream>
 #include <vector>
-#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include "NNPlanner.hpp"
+
+class Backend;
 
 namespace NN {
 
@@ -11,10 +19,55 @@ namespace NN {
 class NNModelMethod {
 public:
   // read method params from model method's params
-  NNModelMethod(const std::string& name, const std::vector<int>& params);
+  NNModelMethod(const std::string& name, const std::vector<int>& params):
+    name(name), inDim(params[0]), inRatio(params[1]),
+    outDim(params[2]), outRatio(params[3]),
+    costs(std::make_shared<CostCurve>()) {}
 
   std::string name;
   int inDim, inRatio, outDim, outRatio;
+  // values in model blocks for a bufferSize: one per channel per frame
+  int inSize(int bufferSize) const { return inDim * (bufferSize / inRatio); }
+  int outSize(int bufferSize) const { return outDim * (bufferSize / outRatio); }
+  // best configuration found by autotune, 0 if not tuned
+  int tunedThreads = 0, tunedBufferSize = 0;
+  float tunedBlockMs = 0;
+  // block duration at minBufferSize before and after freezing, 0 if not frozen
+  float unfrozenBlockMs = 0, frozenBlockMs = 0;
+  // quantized variant compared to the fp32 model on the same input,
+  // 0 if not quantized. The SNR is only set if the fp32 output isn't silent
+  float fp32BlockMs = 0, quantizedBlockMs = 0, quantizedSnr = 0;
+  float fp32Rms = 0, quantizedRmsError = 0;
+  // whether blocks are independent of past ones, probed on load: only
+  // stateless methods are batched
+  bool stateless = false;
+  // measured by the first UGen with an auto buffer size, shared by copies
+  std::shared_ptr<CostCurve> costs;
+};
+
+// floating point type of model weights and computations
+enum NNPrecision { precisionFp32, precisionBf16, precisionFp16 };
+const char* precisionName(NNPrecision precision);
+
+// options for loading a model, from /nn_load
+struct NNLoadOptions {
+  // intra-op threads for this model, 0 for default
+  int threads = 0;
+  // benchmark methods at load, to find their best thread count and buffer size
+  bool autotune = false;
+  // freeze and optimize perform methods for inference
+  bool freeze = false;
+  // directory for cached optimized models and their info, none if empty.
+  // Not owned: must outlive the load
+  const char* cacheDir = nullptr;
+  // reduced precision, if supported by hardware
+  NNPrecision precision = precisionFp32;
+  // pre-quantized variant of the model, to use instead of it. Not owned
+  const char* quantized = nullptr;
+  // used by autotune to check real-time budget
+  double sampleRate = 48000;
+  // name of an nn_daemon to run UGens on, local if empty. Not owned
+  const char* remote = nullptr;
 };
 
 enum NNAttributeType { typeBool, typeInt, typeDouble, typeOther };
@@ -23,15 +76,18 @@ struct NNModelAttribute {
   std::string name;
 };
 
+class NNModelDescLib;
+
 // read and store model information
 // needed mostly to avoid passing strings to UGens
 class NNModelDesc {
 public:
 
-  NNModelDesc(unsigned short id);
+  // lib: the library that stores the model, told when it isn't used anymore
+  NNModelDesc(unsigned short id, NNModelDescLib* lib = nullptr);
 
   // load .ts, just to read info
-  bool load(const char* path);
+  bool load(const char* path, const NNLoadOptions& options = {});
   
   const NNModelMethod* getMethod(unsigned short idx, bool warn=true) const;
   const NNModelAttribute* getAttribute(unsigned short idx, bool warn=true) const;
@@ -40,43 +96,150 @@ public:
   bool is_loaded() const { return m_loaded; }
   void streamInfo(std::ostream& dest) const;
   bool dumpInfo(const char* filename) const;
+  // same info as streamInfo, as numbers for OSC replies: strings are sent as
+  // their length followed by their bytes. Read by NNModelInfo.fromReply
+  void encodeInfo(std::vector<float>& dest) const;
+  static constexpr int infoFormat = 2;
   void printInfo() const;
   int getHigherRatio() const { return m_higherRatio; }
+  unsigned short getIdx() const { return m_idx; }
+  // unique to this model for the plugin's lifetime: ids and addresses are
+  // reused by later models
+  uint64_t getSerial() const { return m_serial; }
   const char* getPath() const { return m_path.c_str(); }
-
+  // UGens run on nn_daemon, which loads the model itself: no model is kept
+  bool isRemote() const { return !m_remote.empty(); }
+  const char* getRemote() const { return m_remote.c_str(); }
+  // loaded model, whose weights are shared by all UGen instances
+  std::shared_ptr<Backend> getBackend() const;
+  // intra-op threads to use for a method, 0 for default
+  int getThreads(const NNModelMethod* method) const;
+
+  // held by UGens and commands while they use the model, so that unloading
+  // or reloading it doesn't free it under them. Lock-free, for the audio thread
+  void retain() const { m_refs.fetch_add(1); }
+  void release() const;
+  int refs() const { return m_refs.load(); }
 
 private:
+  // read methods and attributes from a loaded model
+  void readInfo(Backend& backend);
+  // freeze the loaded model, timing methods before and after
+  bool freeze(Backend& backend);
+  // replace the loaded model with its quantized variant, if it has the same
+  // methods, comparing their outputs and timings
+  bool quantize(std::shared_ptr<Backend>& backend, const char* quantizedPath);
+  void autotune(Backend& backend, double sampleRate);
+  void probeStateless(Backend& backend);
+  // on-disk cache of loaded models, after optimizations
+  static std::string getCacheEntry(const char* cacheDir, const char* path,
+                                   const NNLoadOptions& options);
+  bool readCache(const std::string& entry, Backend& backend);
+  void writeCache(const std::string& entry, Backend& backend) const;
+  // average duration of a block of each method at minBufferSize, in ms
+  std::vector<float> timeMethods(Backend& backend) const;
+
   std::vector<NNModelMethod> m_methods;
   std::vector<NNModelAttribute> m_attributes;
   int m_higherRatio;
   unsigned short m_idx;
+  uint64_t m_serial;
+  NNModelDescLib* m_lib;
   bool m_loaded = false;
   std::string m_path;
+  std::string m_remote;
+  int m_threads = 0;
+  bool m_frozen = false;
+  bool m_quantized = false;
+  NNPrecision m_precision = precisionFp32;
+  std::shared_ptr<Backend> m_backend;
+  mutable std::mutex m_backendMutex;
+  mutable std::atomic<int> m_refs{0};
+};
+
+// reference to a retained model, released when it goes out of scope
+class NNModelRef {
+public:
+  // takes over a reference already retained
+  explicit NNModelRef(NNModelDesc* model = nullptr): m_model(model) {}
+  NNModelRef(NNModelRef&& other): m_model(std::exchange(other.m_model, nullptr)) {}
+  NNModelRef(const NNModelRef&) = delete;
+  NNModelRef& operator=(const NNModelRef&) = delete;
+  ~NNModelRef() { if (m_model) m_model->release(); }
+
+  NNModelDesc* get() const { return m_model; }
+  NNModelDesc* operator->() const { return m_model; }
+  explicit operator bool() const { return m_model != nullptr; }
+
+private:
+  NNModelDesc* m_model;
 };
 
 // register model info by int id
-// used as a global NNModelDesc store
+// used as a global NNModelDesc store.
+// Lookups are lock-free and don't allocate, so that UGens can do them on the
+// audio thread: models are indexed by id in an immutable snapshot, that
+// writers copy, update and publish. Replaced snapshots and models are
+// retired, and freed once no reader can reach them and no one holds a
+// reference to them anymore: by a later writer, or when their last
+// reference is released
 class NNModelDescLib {
 public:
-  NNModelDescLib();
-  // load model from .ts file
-  NNModelDesc* load(const char* path);
-  NNModelDesc* load(unsigned short id, const char* path);
+  // requestCollect: called when a retired model may have become unused, from
+  // any thread, the audio thread included. It should have collectRetired
+  // called where blocking is fine. Without it, writers collect
+  explicit NNModelDescLib(void (*requestCollect)() = nullptr);
+  ~NNModelDescLib();
+  // load model from .ts file. Loading at a used id replaces its model
+  NNModelRef load(const char* path, const NNLoadOptions& options = {});
+  NNModelRef load(unsigned short id, const char* path, const NNLoadOptions& options = {});
   void unload(unsigned short id);
   /* void reload(unsigned short id); */
 
-  // get stored model
-  NNModelDesc* get(unsigned short id, bool warn=true) const;
+  // get stored model, retained
+  NNModelRef get(unsigned short id, bool warn=true) const;
   // all loaded models info
   void streamAllInfo(std::ostream& stream) const;
   bool dumpAllInfo(const char* filename) const;
   void printAllInfo() const;
 
+  // free retired models that aren't used anymore. Blocks: not for the
+  // audio thread
+  void collectRetired();
+  // a model's last reference was released
+  void onUnused() const;
+
 private:
+  // models by id, nullptr for free ids
+  using Snapshot = std::vector<NNModelDesc*>;
+
+  // keeps the current snapshot, and retired ones, from being freed while
+  // reading them
+  class ReadSection {
+  public:
+    ReadSection(const NNModelDescLib& lib): m_lib(lib) { m_lib.m_readers.fetch_add(1); }
+    ~ReadSection() { m_lib.m_readers.fetch_sub(1); }
+    const Snapshot& snapshot() const { return *m_lib.m_current.load(); }
+  private:
+    const NNModelDescLib& m_lib;
+  };
+
+  // writers hold m_writeMutex
   unsigned short getNextId();
-  std::map<unsigned short, NNModelDesc*> models;
-  unsigned short modelCount;
-
+  // publish model at id, retiring the model it replaces
+  void publish(unsigned short id, NNModelDesc* model);
+  // free retired snapshots and models that can't be reached anymore
+  void collect();
+
+  std::atomic<const Snapshot*> m_current;
+  mutable std::atomic<int> m_readers{0};
+  std::mutex m_writeMutex;
+  std::vector<const Snapshot*> m_retiredSnapshots;
+  std::vector<NNModelDesc*> m_retiredModels;
+  // size of m_retiredModels, for releases
+  std::atomic<int> m_numRetired{0};
+  void (*m_requestCollect)();
+  unsigned short m_nextId;
 };
 
 } // namespace RAVE
@@ -1,10 +1,31 @@
 #include "NNModelCmd.hpp"
 #include "NNModel.hpp"
+#include "NNBackendPool.hpp"
+#include "NNLoader.hpp"
+#include "NNOffline.hpp"
+#include "NNStats.hpp"
+#include "NNWorkerPool.hpp"
+#include "backend/backend.h"
 #include "SC_InterfaceTable.h"
 #include "SC_PlugIn.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
 
 extern InterfaceTable* ft;
 extern NN::NNModelDescLib gModels;
+extern NN::BackendPool gBackendPool;
+extern NN::StatsRegistry gStats;
+extern NN::ModelLoader gLoader;
+extern NN::WorkerPool gWorkers;
+extern NN::WorkerPool gBackground;
 
 inline char* copyStrToBuf(char** buf, const char* str) {
   char* res = strcpy(*buf, str); *buf += strlen(str) + 1;
@@ -13,18 +34,195 @@ inline char* copyStrToBuf(char** buf, const char* str) {
 
 namespace NN::Cmd {
 
-// /cmd /nn_set str str str
+// values in a node reply: its packet must fit in a UDP datagram
+constexpr size_t maxReplyValues = 8192;
+
+// to all clients registered for notifications. Replies need a node:
+// the root group's, which a group starts with
+static void sendReply(World* world, const char* cmdName, int replyID,
+                      const std::vector<float>& values) {
+  SendNodeReply(reinterpret_cast<Node*>(world->mTopGroup), replyID,
+                cmdName, values.size(), values.data());
+}
+
+// plugin threads are only needed by real-time servers: started by the
+// first command that hands work over to them, from the NRT thread. UGens
+// need a loaded model, so workers are running before any UGen submits to them
+static void startThreads(World* world) {
+  if (!world->mRealTime) return;
+  gLoader.start();
+  gWorkers.start();
+  gBackground.start();
+}
+
+// work handed over to the loader, that the audio thread waits for, and
+// replies to with cmdName once done
+struct LoaderTask {
+  LoaderTask(const char* cmdName, int replyID): cmdName(cmdName), replyID(replyID) {}
+  virtual ~LoaderTask() = default;
+  // on the loader, filling reply
+  virtual void run() = 0;
+  // NRT thread, once run and before replying: hand results over to the
+  // server, which may have changed meanwhile
+  virtual void finish() {}
+
+  const char* cmdName;
+  int replyID;
+  std::atomic<bool> done{false};
+  std::vector<float> reply;
+};
+
+// tasks the audio thread waits for, to reply once they're done. A single
+// round trip through the NRT thread at a time checks all of them, waiting
+// there up to pollInterval for one to finish: the audio thread isn't called
+// back on every control block, and other commands wait at most that long
+class TaskPoller {
+public:
+  static constexpr std::chrono::milliseconds pollInterval{10};
+
+  // NRT thread: run task on the loader. Returns true if nothing polls yet:
+  // the command's stage 3 then starts polling
+  bool submit(int key, LoaderTask* task);
+  // RT: start a round trip
+  void start(World* world);
+
+private:
+  static void run(void* task);
+  // stage 2 (NRT): free tasks replied to, and collect and finish done ones
+  static bool poll(World* world, void* data);
+  // stage 3 (RT): reply to done tasks, and poll again while any is left
+  static bool reply(World* world, void* data);
+  bool anyDone() const;
+
+  // NRT thread only
+  std::vector<LoaderTask*> m_running;
+  bool m_polling = false;
+  // handed over from stage 2 to stage 3 of a round trip
+  std::vector<LoaderTask*> m_done;
+  bool m_more = false;
+  // loader threads wake a waiting poll
+  std::mutex m_mutex;
+  std::condition_variable m_cond;
+};
+
+static TaskPoller gTasks;
+
+bool TaskPoller::submit(int key, LoaderTask* task) {
+  m_running.push_back(task);
+  gLoader.submit(key, {run, task});
+  if (m_polling) return false;
+  m_polling = true;
+  return true;
+}
+
+void TaskPoller::run(void* data) {
+  auto task = static_cast<LoaderTask*>(data);
+  task->run();
+  {
+    std::lock_guard<std::mutex> lock(gTasks.m_mutex);
+    task->done.store(true, std::memory_order_release);
+  }
+  gTasks.m_cond.notify_all();
+}
+
+void TaskPoller::start(World* world) {
+  DoAsynchronousCommand(world, nullptr, "", this, poll, reply, nullptr, nullptr, 0, nullptr);
+}
+
+bool TaskPoller::anyDone() const {
+  return std::any_of(m_running.begin(), m_running.end(), [](LoaderTask* task) {
+    return task->done.load(std::memory_order_acquire);
+  });
+}
+
+bool TaskPoller::poll(World*, void* data) {
+  auto& self = *static_cast<TaskPoller*>(data);
+  for (auto task: self.m_done) delete task;
+  self.m_done.clear();
+  if (!self.m_running.empty()) {
+    std::unique_lock<std::mutex> lock(self.m_mutex);
+    self.m_cond.wait_for(lock, pollInterval, [&] { return self.anyDone(); });
+  }
+  auto done = std::stable_partition(
+    self.m_running.begin(), self.m_running.end(),
+    [](LoaderTask* task) { return !task->done.load(std::memory_order_acquire); });
+  self.m_done.assign(done, self.m_running.end());
+  self.m_running.erase(done, self.m_running.end());
+  for (auto task: self.m_done) task->finish();
+  // done tasks are freed by the next round trip
+  self.m_more = !self.m_running.empty() || !self.m_done.empty();
+  if (!self.m_more) self.m_polling = false;
+  return true;
+}
+
+bool TaskPoller::reply(World* world, void* data) {
+  auto& self = *static_cast<TaskPoller*>(data);
+  for (auto task: self.m_done)
+    sendReply(world, task->cmdName, task->replyID, task->reply);
+  if (self.m_more) self.start(world);
+  return false;
+}
+
+// stage 3 (RT) of commands handing a task over
+template <class CmdData> bool startPolling(World* world, void* inData) {
+  auto data = static_cast<CmdData*>(inData);
+  if (data->startPolling) gTasks.start(world);
+  return false;
+}
+
+// /cmd /nn_load int str str [str int ...]
+// optional trailing (option, value) pairs set NNLoadOptions, and replyID
+// tags the /nn_loaded notification
 struct LoadCmdData {
 public:
   int id;
+  int replyID;
   const char* path;
   const char* filename;
+  NNLoadOptions options;
+  // set by stage 2 when the load is the first task to wait for
+  bool startPolling;
 
   static LoadCmdData* alloc(sc_msg_iter* args, World* world=nullptr) {
 
     int id = args->geti(-1);
     const char* path = args->gets();
     const char* filename = args->gets("");
+    NNLoadOptions options;
+    int replyID = -1;
+    const char* cacheDir = "";
+    const char* quantized = "";
+    const char* remote = "";
+    while (args->remain() > 0) {
+      const char* option = args->gets("");
+      if (strlen(option) == 0) break;
+      if (strcmp(option, "cacheDir") == 0) {
+        cacheDir = args->gets("");
+        continue;
+      }
+      if (strcmp(option, "quantized") == 0) {
+        quantized = args->gets("");
+        continue;
+      }
+      if (strcmp(option, "remote") == 0) {
+        remote = args->gets("");
+        continue;
+      }
+      if (strcmp(option, "precision") == 0) {
+        const char* precision = args->gets("");
+        if (strcmp(precision, "bf16") == 0) options.precision = precisionBf16;
+        else if (strcmp(precision, "fp16") == 0) options.precision = precisionFp16;
+        else if (strcmp(precision, "fp32") != 0)
+          Print("nn_load: unknown precision '%s'\n", precision);
+        continue;
+      }
+      int value = args->geti(0);
+      if (strcmp(option, "replyID") == 0) replyID = value;
+      else if (strcmp(option, "threads") == 0) options.threads = value;
+      else if (strcmp(option, "autotune") == 0) options.autotune = value > 0;
+      else if (strcmp(option, "freeze") == 0) options.freeze = value > 0;
+      else Print("nn_load: unknown option '%s'\n", option);
+    }
 
     if (path == 0) {
       Print("Error: nn_load needs a path to a .ts file\n");
@@ -33,7 +231,10 @@ public:
 
     size_t dataSize = sizeof(LoadCmdData)
       + strlen(path) + 1
-      + strlen(filename) + 1;
+      + strlen(filename) + 1
+      + strlen(cacheDir) + 1
+      + strlen(quantized) + 1
+      + strlen(remote) + 1;
 
     LoadCmdData* cmdData = (LoadCmdData*) (world ? RTAlloc(world, dataSize) : NRTAlloc(dataSize));
     if (cmdData == nullptr) {
@@ -43,44 +244,101 @@ public:
 
     char* data = (char*) (cmdData + 1);
     cmdData->id = id;
+    cmdData->replyID = replyID;
+    cmdData->startPolling = false;
+    cmdData->options = options;
     cmdData->path = copyStrToBuf(&data, path);
     cmdData->filename = copyStrToBuf(&data, filename);
+    cmdData->options.cacheDir = copyStrToBuf(&data, cacheDir);
+    cmdData->options.quantized = copyStrToBuf(&data, quantized);
+    cmdData->options.remote = copyStrToBuf(&data, remote);
     return cmdData;
   }
 
   LoadCmdData() = delete;
 };
 
-bool nn_load(World* world, void* inData) {
-  LoadCmdData* data = (LoadCmdData*)inData;
-  int id = data->id;
-  const char* path = data->path;
-  const char* filename = data->filename;
+// a load on the loader: copies the command's strings, that are freed with it
+struct LoadTask: LoaderTask {
+  LoadTask(const LoadCmdData& data, double sampleRate):
+    LoaderTask("/nn_loaded", data.replyID),
+    id(data.id), path(data.path), filename(data.filename),
+    cacheDir(data.options.cacheDir), quantized(data.options.quantized),
+    remote(data.options.remote), options(data.options) {
+    options.cacheDir = cacheDir.c_str();
+    options.quantized = quantized.c_str();
+    options.remote = remote.c_str();
+    options.sampleRate = sampleRate;
+  }
 
-  // Print("nn_load: idx %d path %s\n", id, path);
-  auto model = (id == -1) ? gModels.load(path) : gModels.load(id, path);
+  // /nn_loaded values: loaded id, success, and model info if it fits
+  void run() override;
 
-  if (model != nullptr && strlen(filename) > 0) {
-    model->dumpInfo(filename);
+  int id;
+  std::string path, filename, cacheDir, quantized, remote;
+  NNLoadOptions options;
+};
+
+static bool loadModel(LoadTask& task) {
+  // Print("nn_load: idx %d path %s\n", task.id, task.path.c_str());
+  // pooled instances of a model being reloaded are stale
+  if (task.id != -1) {
+    auto prevModel = gModels.get(task.id, false);
+    if (prevModel) gBackendPool.clear(prevModel.get());
   }
-  return true;
+  auto model = (task.id == -1) ? gModels.load(task.path.c_str(), task.options)
+                               : gModels.load(task.id, task.path.c_str(), task.options);
+
+  if (model && !task.filename.empty()) {
+    model->dumpInfo(task.filename.c_str());
+  }
+  // larger info can be written to a file with /nn_query
+  task.reply = { static_cast<float>(model ? model->getIdx() : task.id), model ? 1.f : 0.f };
+  if (model) {
+    model->encodeInfo(task.reply);
+    if (task.reply.size() > maxReplyValues) task.reply.resize(2);
+  }
+  return static_cast<bool>(model);
 }
 
+void LoadTask::run() { loadModel(*this); }
+
+// stage 2: NRT servers load right away, to keep score order. Real-time
+// ones hand the load over to the loader
+bool nn_load(World* world, void* inData) {
+  LoadCmdData* data = (LoadCmdData*)inData;
+  auto task = new LoadTask(*data, world->mSampleRate);
+  if (!world->mRealTime) {
+    loadModel(*task);
+    delete task;
+    return true;
+  }
+  startThreads(world);
+  data->startPolling = gTasks.submit(task->id, task);
+  return true;
+}
 
-// /cmd /nn_query str
+// /cmd /nn_query int str int
+// with a replyID, a single model's info is sent back with /nn_info
 struct QueryCmdData {
 public:
   int modelIdx;
   const char* outFile;
+  int replyID;
+  // encoded by stage 2, sent by stage 3
+  std::vector<float>* reply;
 
   static QueryCmdData* alloc(sc_msg_iter* args, World* world=nullptr) {
     int modelIdx = args->geti(-1);
     const char* outFile = args->gets("");
+    int replyID = args->geti(-1);
 
     auto dataSize = sizeof(QueryCmdData) + strlen(outFile) + 1;
     QueryCmdData* cmdData = (QueryCmdData*) (world ? RTAlloc(world, dataSize) : NRTAlloc(dataSize));
     if (cmdData == nullptr) { Print("nn_query: alloc failed.\n"); return nullptr; }
     cmdData->modelIdx = modelIdx;
+    cmdData->replyID = replyID;
+    cmdData->reply = nullptr;
     char* data = (char*) (cmdData + 1);
     cmdData->outFile = copyStrToBuf(&data, outFile);
     
@@ -100,12 +358,32 @@ bool nn_query(World* world, void* inData) {
     return true;
   }
   const auto model = gModels.get(static_cast<unsigned short>(modelIdx), true);
-  if (model) {
-    if (writeToFile) model->dumpInfo(outFile); else model->printInfo();
+  if (!model) return true;
+  if (writeToFile) model->dumpInfo(outFile);
+  if (data->replyID >= 0) {
+    data->reply = new std::vector<float>();
+    model->encodeInfo(*data->reply);
+    if (data->reply->size() > maxReplyValues) data->reply->clear();
+  } else if (!writeToFile) {
+    model->printInfo();
   }
   return true;
 }
 
+// stage 3 (RT): an empty /nn_info if the info didn't fit
+bool nn_query_reply(World* world, void* inData) {
+  QueryCmdData* data = (QueryCmdData*)inData;
+  if (data->reply == nullptr) return false;
+  sendReply(world, "/nn_info", data->replyID, *data->reply);
+  return true;
+}
+
+// stage 4
+bool nn_query_done(World* world, void* inData) {
+  delete static_cast<QueryCmdData*>(inData)->reply;
+  return false;
+}
+
 
 // /nn_unload i
 struct UnloadCmdData {
@@ -129,60 +407,370 @@ public:
   UnloadCmdData() = delete;
 };
 
+static void unloadModel(int id) {
+  auto model = gModels.get(id, false);
+  if (model) gBackendPool.clear(model.get());
+  gModels.unload(id);
+}
+
+static void unload_task(void* data) {
+  unloadModel(static_cast<int>(reinterpret_cast<intptr_t>(data)));
+}
+
+// freeing pooled instances and models can take a while: on the loader,
+// after loads of the same id
 bool nn_unload(World* world, void* inData) {
   UnloadCmdData* data = (UnloadCmdData*)inData;
   int id = data->id;
 
-  gModels.unload(id);
+  if (!world->mRealTime || id < 0) {
+    unloadModel(id);
+    return true;
+  }
+  startThreads(world);
+  gLoader.submit(id, {unload_task, reinterpret_cast<void*>(static_cast<intptr_t>(id))});
 
   return true;
 }
 
-// /cmd /nn_warmup int int
-/* struct WarmupCmdData { */
-/* public: */
-/*   int modelIdx; */
-/*   int methodIdx; */
+// /cmd /nn_pool int int int int int int
+// with a replyID, /nn_pooled tells when real-time servers are done
+struct PoolCmdData {
+public:
+  int modelIdx;
+  int methodIdx;
+  int bufferSize;
+  int count;
+  int warmup;
+  int replyID;
+  // set by stage 2 when filling is the first task to wait for
+  bool startPolling;
+
+  static PoolCmdData* alloc(sc_msg_iter* args, World* world=nullptr) {
+    int modelIdx = args->geti(-1);
+    int methodIdx = args->geti(-1);
+    int bufferSize = args->geti(-1);
+    int count = args->geti(1);
+    int warmup = args->geti(1);
+    int replyID = args->geti(-1);
+
+    auto dataSize = sizeof(PoolCmdData);
+    PoolCmdData* cmdData = (PoolCmdData*) (world ? RTAlloc(world, dataSize) : NRTAlloc(dataSize));
+    if (cmdData == nullptr) { Print("nn_pool: alloc failed.\n"); return nullptr; }
+    cmdData->modelIdx = modelIdx;
+    cmdData->methodIdx = methodIdx;
+    cmdData->bufferSize = bufferSize;
+    cmdData->count = count;
+    cmdData->warmup = warmup;
+    cmdData->replyID = replyID;
+    cmdData->startPolling = false;
+    
+    return cmdData;
+  }
 
-/*   static WarmupCmdData* alloc(sc_msg_iter* args, World* world=nullptr) { */
-/*     int modelIdx = args->geti(-1); */
-/*     int methodIdx = args->geti(-1); */
+  PoolCmdData() = delete;
+};
+
+// the model is looked up when the task runs: after loads and unloads of
+// its id submitted before, so that instances are never added for a model
+// that was replaced meanwhile
+struct PoolTask: LoaderTask {
+  PoolTask(const PoolCmdData& data):
+    LoaderTask("/nn_pooled", data.replyID), modelIdx(data.modelIdx),
+    methodIdx(data.methodIdx), bufferSize(data.bufferSize),
+    count(data.count), warmup(data.warmup) {
+    // /nn_pooled values: model, method, success
+    reply = { static_cast<float>(modelIdx), static_cast<float>(methodIdx), 0.f };
+  }
+
+  void run() override;
+
+  int modelIdx, methodIdx, bufferSize, count, warmup;
+};
+
+void PoolTask::run() {
+  const auto model = gModels.get(static_cast<unsigned short>(modelIdx), true);
+  if (!model) return;
+  auto method = model->getMethod(methodIdx, true);
+  if (method == nullptr) return;
+  if (model->isRemote()) {
+    Print("nn_pool: %s runs on nn_daemon, nothing to pool\n", model->getPath());
+    return;
+  }
+
+  // same buffer size as NNUGen would choose: the smallest by default
+  int higherRatio = model->getHigherRatio();
+  int poolBufferSize = OfflineProcessor::resolveBufferSize(bufferSize, higherRatio,
+                                                          higherRatio);
+  if (gBackendPool.fill(model.get(), method, poolBufferSize, count, warmup))
+    reply[2] = 1.f;
+}
+
+// stage 2: loading and warming up instances takes a while: on the loader,
+// in order with the model's loads and unloads. NRT servers fill right away
+bool nn_pool(World* world, void* inData) {
+  PoolCmdData* data = (PoolCmdData*)inData;
+  if (data->modelIdx < 0) {
+    Print("nn_pool: invalid model index %d\n", data->modelIdx);
+    return true;
+  }
+  auto task = new PoolTask(*data);
+  if (!world->mRealTime) {
+    task->run();
+    delete task;
+    return true;
+  }
+  startThreads(world);
+  data->startPolling = gTasks.submit(data->modelIdx, task);
+  return true;
+}
+
+// /cmd /nn_threads int int
+struct ThreadsCmdData {
+public:
+  int intraOp;
+  int interOp;
+
+  static ThreadsCmdData* alloc(sc_msg_iter* args, World* world=nullptr) {
+    int intraOp = args->geti(-1);
+    int interOp = args->geti(-1);
+
+    auto dataSize = sizeof(ThreadsCmdData);
+    ThreadsCmdData* cmdData = (ThreadsCmdData*) (world ? RTAlloc(world, dataSize) : NRTAlloc(dataSize));
+    if (cmdData == nullptr) { Print("nn_threads: alloc failed.\n"); return nullptr; }
+    cmdData->intraOp = intraOp;
+    cmdData->interOp = interOp;
+    return cmdData;
+  }
+
+  ThreadsCmdData() = delete;
+};
+
+// set default intra-op threads for models without their own setting,
+// and inter-op threads (only possible before any model has run).
+// Negative values leave the current setting unchanged
+bool nn_threads(World* world, void* inData) {
+  ThreadsCmdData* data = (ThreadsCmdData*)inData;
+  if (data->intraOp >= 0)
+    Backend::set_default_num_threads(data->intraOp);
+  if (data->interOp > 0 && !Backend::set_num_interop_threads(data->interOp))
+    Print("nn_threads: can't set inter-op threads after models have run\n");
+  return true;
+}
+
+// /cmd /nn_process_buffer int int int int int int int
+// with a replyID, /nn_processed tells when real-time servers are done
+struct ProcessBufferCmdData {
+public:
+  int modelIdx;
+  int methodIdx;
+  int srcBufNum;
+  int dstBufNum;
+  int bufferSize;
+  int batch;
+  int replyID;
+  // set by stage 2 when processing is the first task to wait for
+  bool startPolling;
+
+  static ProcessBufferCmdData* alloc(sc_msg_iter* args, World* world=nullptr) {
+    int modelIdx = args->geti(-1);
+    int methodIdx = args->geti(-1);
+    int srcBufNum = args->geti(-1);
+    int dstBufNum = args->geti(-1);
+    int bufferSize = args->geti(-1);
+    int batch = args->geti(8);
+    int replyID = args->geti(-1);
+
+    auto dataSize = sizeof(ProcessBufferCmdData);
+    ProcessBufferCmdData* cmdData = (ProcessBufferCmdData*) (world ? RTAlloc(world, dataSize) : NRTAlloc(dataSize));
+    if (cmdData == nullptr) { Print("nn_process_buffer: alloc failed.\n"); return nullptr; }
+    cmdData->modelIdx = modelIdx;
+    cmdData->methodIdx = methodIdx;
+    cmdData->srcBufNum = srcBufNum;
+    cmdData->dstBufNum = dstBufNum;
+    cmdData->bufferSize = bufferSize;
+    cmdData->batch = batch;
+    cmdData->replyID = replyID;
+    cmdData->startPolling = false;
+    return cmdData;
+  }
+
+  ProcessBufferCmdData() = delete;
+};
+
+static SndBuf* getNRTBuf(World* world, int bufNum) {
+  if (bufNum < 0 || bufNum >= world->mNumSndBufs) {
+    Print("nn_process_buffer: invalid buffer %d\n", bufNum);
+    return nullptr;
+  }
+  SndBuf* buf = World_GetNRTBuf(world, bufNum);
+  if (buf->data == nullptr) {
+    Print("nn_process_buffer: buffer %d is not allocated\n", bufNum);
+    return nullptr;
+  }
+  return buf;
+}
+
+// a method run over a whole buffer into another one, one value per model
+// frame, on a model instance of its own. Buffers are checked by the command,
+// which copies the source: buffers can be freed or reallocated while the
+// loader processes. The output is written to the destination by finish,
+// only if it's still the buffer that was checked
+struct ProcessTask: LoaderTask {
+  ProcessTask(World* world, const ProcessBufferCmdData& data, NNModelRef model,
+              const NNModelMethod& method, const SndBuf* src, const SndBuf* dst):
+    LoaderTask("/nn_processed", data.replyID), world(world), model(std::move(model)),
+    method(method), input(src->data, src->data + src->samples),
+    srcFrames(src->frames), dstBufNum(data.dstBufNum), dstData(dst->data),
+    dstFrames(dst->frames), dstChannels(dst->channels),
+    bufferSize(data.bufferSize), batch(data.batch) {
+    // /nn_processed values: destination buffer, success
+    reply = { static_cast<float>(data.dstBufNum), 0.f };
+  }
+
+  void run() override;
+  void finish() override;
+
+  World* world;
+  NNModelRef model;
+  const NNModelMethod& method;
+  std::vector<float> input;
+  int srcFrames;
+  // destination when the command was checked, to write back to
+  int dstBufNum;
+  const float* dstData;
+  int dstFrames, dstChannels;
+  int bufferSize, batch;
+  // frames to write back, dstChannels each
+  std::vector<float> output;
+};
+
+void ProcessTask::run() {
+  int chunkSize = OfflineProcessor::resolveBufferSize(bufferSize, model->getHigherRatio());
+  auto shared = model->getBackend();
+  Backend backend;
+  if (!shared || backend.load(*shared)) {
+    Print("nn_process_buffer: ERROR loading %s\n", model->getPath());
+    return;
+  }
+  backend.set_num_threads(model->getThreads(&method));
+  OfflineProcessor processor(backend, method, chunkSize, batch);
+  if (!processor.prepare()) {
+    Print("nn_process_buffer: ERROR binding %s\n", method.name.c_str());
+    return;
+  }
+  int outFrames = processor.outFrames(srcFrames);
+  if (dstFrames < outFrames)
+    Print("nn_process_buffer: output truncated to %d frames, needs %d\n",
+          dstFrames, outFrames);
+  outFrames = std::min(outFrames, dstFrames);
+  output.resize(static_cast<size_t>(outFrames) * dstChannels);
+
+  auto start = std::chrono::steady_clock::now();
+  processor.process(input.data(), srcFrames, output.data(), outFrames);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  double duration = static_cast<double>(srcFrames) * method.inRatio / world->mSampleRate;
+  Print("nn_process_buffer: %s %.1fs in %.2fs (%.1fx real time, batch %d)\n",
+        method.name.c_str(), duration, elapsed.count(),
+        duration / elapsed.count(), processor.batchSize());
+  reply[1] = 1.f;
+}
+
+void ProcessTask::finish() {
+  if (reply[1] == 0.f) return;
+  SndBuf* dst = World_GetNRTBuf(world, dstBufNum);
+  if (dst->data != dstData || dst->frames != dstFrames || dst->channels != dstChannels) {
+    Print("nn_process_buffer: buffer %d changed while processing, output dropped\n",
+          dstBufNum);
+    reply[1] = 0.f;
+    return;
+  }
+  std::copy(output.begin(), output.end(), dst->data);
+}
+
+// stage 2: NRT servers process right away, to keep score order. Real-time
+// ones hand processing over to the loader, not to hold up other commands
+bool nn_process_buffer(World* world, void* inData) {
+  ProcessBufferCmdData* data = (ProcessBufferCmdData*)inData;
+  if (data->modelIdx < 0) {
+    Print("nn_process_buffer: invalid model index %d\n", data->modelIdx);
+    return true;
+  }
+  auto model = gModels.get(static_cast<unsigned short>(data->modelIdx), true);
+  if (!model) return true;
+  auto method = model->getMethod(data->methodIdx, true);
+  if (method == nullptr) return true;
+  SndBuf* src = getNRTBuf(world, data->srcBufNum);
+  SndBuf* dst = getNRTBuf(world, data->dstBufNum);
+  if (src == nullptr || dst == nullptr) return true;
+  if (src->channels != method->inDim || dst->channels != method->outDim) {
+    Print("nn_process_buffer: %s needs %d input and %d output channels, buffers have %d and %d\n",
+          method->name.c_str(), method->inDim, method->outDim, src->channels, dst->channels);
+    return true;
+  }
+
+  if (model->isRemote()) {
+    Print("nn_process_buffer: %s runs on nn_daemon, load it locally to process buffers\n",
+          model->getPath());
+    return true;
+  }
+
+  auto task = new ProcessTask(world, *data, std::move(model), *method, src, dst);
+  if (!world->mRealTime) {
+    task->run();
+    task->finish();
+    delete task;
+    return true;
+  }
+  startThreads(world);
+  data->startPolling = gTasks.submit(-1, task);
+  return true;
+}
+
+// /cmd /nn_stats str int
+struct StatsCmdData {
+public:
+  int reset;
+  const char* outFile;
+
+  static StatsCmdData* alloc(sc_msg_iter* args, World* world=nullptr) {
+    const char* outFile = args->gets("");
+    int reset = args->geti(0);
+
+    auto dataSize = sizeof(StatsCmdData) + strlen(outFile) + 1;
+    StatsCmdData* cmdData = (StatsCmdData*) (world ? RTAlloc(world, dataSize) : NRTAlloc(dataSize));
+    if (cmdData == nullptr) { Print("nn_stats: alloc failed.\n"); return nullptr; }
+    cmdData->reset = reset;
+    char* data = (char*) (cmdData + 1);
+    cmdData->outFile = copyStrToBuf(&data, outFile);
+    return cmdData;
+  }
+
+  StatsCmdData() = delete;
+};
+
+// timings of all live instances, as YAML to a file or to console.
+// Optionally start counting again from now
+bool nn_stats(World* world, void* inData) {
+  StatsCmdData* data = (StatsCmdData*)inData;
+  if (strlen(data->outFile) > 0) {
+    std::ofstream file(data->outFile);
+    if (!file.is_open()) {
+      Print("nn_stats: couldn't open file %s\n", data->outFile);
+      return true;
+    }
+    gStats.stream(file, gModels, world->mSampleRate);
+  } else {
+    gStats.stream(std::cout, gModels, world->mSampleRate);
+    std::cout << std::endl;
+  }
+  if (data->reset) gStats.reset();
+  return true;
+}
 
-/*     auto dataSize = sizeof(WarmupCmdData); */
-/*     WarmupCmdData* cmdData = (WarmupCmdData*) (world ? RTAlloc(world, dataSize) : NRTAlloc(dataSize)); */
-/*     if (cmdData == nullptr) { Print("nn_warmup: alloc failed.\n"); return nullptr; } */
-/*     cmdData->modelIdx = modelIdx; */
-/*     cmdData->methodIdx = methodIdx; */
-    
-/*     return cmdData; */
-/*   } */
-
-/*   WarmupCmdData() = delete; */
-/* }; */
-
-/* bool nn_warmup(World* world, void* inData) { */
-/*   WarmupCmdData* data = (WarmupCmdData*)inData; */
-/*   int modelIdx = data->modelIdx; */
-/*   int methodIdx = data->methodIdx; */
-/*   if (modelIdx < 0) { */
-/*     Print("nn_warmup: invalid model index %d\n", modelIdx); */
-/*     return true; */
-/*   } */
-/*   const auto model = gModels.get(static_cast<unsigned short>(modelIdx), true); */
-/*   if (model) { */
-/*     if (methodIdx < 0) { */
-/*       // warmup all methods */
-/*       for(auto method: model->m_methods) model->warmup_method(&method); */
-/*     } else { */
-/*       auto method = model->getMethod(methodIdx, true); */
-/*       if (method) model->warmup_method(method); */
-/*     } */
-/*   } */
-/*   return true; */
-/* } */
 void nrtFree(World*, void* data) { NRTFree(data); }
 
-template<class CmdData, auto cmdFn>
+template<class CmdData, auto cmdFn, AsyncStageFn rtFn = nullptr, AsyncStageFn nrtDoneFn = nullptr>
 void asyncCmd(World* world, void* inUserData, sc_msg_iter* args, void* replyAddr) {
   const char* cmdName = ""; // used only in /done, we use /sync instead
   CmdData* data = CmdData::alloc(args, nullptr);
@@ -190,16 +778,19 @@ void asyncCmd(World* world, void* inUserData, sc_msg_iter* args, void* replyAddr
   DoAsynchronousCommand(
     world, replyAddr, cmdName, data,
     cmdFn, // stage2 is non real time
-    nullptr, // stage3: RT (completion msg performed if true)
-    nullptr, // stage4: NRT (sends /done if true)
+    rtFn, // stage3: RT (completion msg performed if true)
+    nrtDoneFn, // stage4: NRT (sends /done if true)
     nrtFree, 0, 0);
 }
 
 void definePlugInCmds() {
-  DefinePlugInCmd("/nn_load", asyncCmd<LoadCmdData, nn_load>, nullptr);
-  DefinePlugInCmd("/nn_query", asyncCmd<QueryCmdData, nn_query>, nullptr);
+  DefinePlugInCmd("/nn_load", asyncCmd<LoadCmdData, nn_load, startPolling<LoadCmdData>>, nullptr);
+  DefinePlugInCmd("/nn_query", asyncCmd<QueryCmdData, nn_query, nn_query_reply, nn_query_done>, nullptr);
   DefinePlugInCmd("/nn_unload", asyncCmd<UnloadCmdData, nn_unload>, nullptr);
-  /* DefinePlugInCmd("/nn_warmup", asyncCmd<WarmupCmdData, nn_warmup>, nullptr); */
+  DefinePlugInCmd("/nn_pool", asyncCmd<PoolCmdData, nn_pool, startPolling<PoolCmdData>>, nullptr);
+  DefinePlugInCmd("/nn_threads", asyncCmd<ThreadsCmdData, nn_threads>, nullptr);
+  DefinePlugInCmd("/nn_process_buffer", asyncCmd<ProcessBufferCmdData, nn_process_buffer, startPolling<ProcessBufferCmdData>>, nullptr);
+  DefinePlugInCmd("/nn_stats", asyncCmd<StatsCmdData, nn_stats>, nullptr);
 }
 
 } // namespace NN::Cmd
@@ -0,0 +1,84 @@
+// NNMpmcQueue.hpp
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace NN {
+
+// lock-free queue between any number of producer and consumer threads, with
+// fixed capacity: no allocation nor locks on push and pop, so that the audio
+// thread can push without waiting for consumers.
+// Each cell has a sequence number telling whether it's ready to be written
+// or read in the current lap, and positions are claimed by compare-exchange
+template <class T, size_t Capacity> class MpmcQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "MpmcQueue capacity must be a power of two");
+
+public:
+  MpmcQueue() {
+    for (size_t i = 0; i < Capacity; ++i)
+      m_cells[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  // false only if the queue is full
+  bool push(const T& item) {
+    size_t pos = m_tail.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &m_cells[pos & (Capacity - 1)];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_tail.load(std::memory_order_relaxed);
+      }
+    }
+    cell->item = item;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  // false if the queue is empty, or if the first item is still being
+  // written by its producer
+  bool pop(T& item) {
+    size_t pos = m_head.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &m_cells[pos & (Capacity - 1)];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = m_head.load(std::memory_order_relaxed);
+      }
+    }
+    item = cell->item;
+    // ready to be written in the next lap
+    cell->seq.store(pos + Capacity, std::memory_order_release);
+    return true;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T item;
+  };
+
+  std::array<Cell, Capacity> m_cells;
+  // producers and consumers on separate cache lines
+  alignas(64) std::atomic<size_t> m_tail{0};
+  alignas(64) std::atomic<size_t> m_head{0};
+};
+
+} // namespace NN
@@ -0,0 +1,107 @@
+// NNOffline.cpp
+#include "NNOffline.hpp"
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+namespace NN {
+
+OfflineProcessor::OfflineProcessor(Backend& backend, const NNModelMethod& method,
+                                   int bufferSize, int maxBatch):
+  m_backend(backend), m_method(method), m_bufferSize(bufferSize),
+  m_maxBatch(std::max(1, maxBatch)), m_batch(1) {}
+
+int OfflineProcessor::resolveBufferSize(int bufferSize, int higherRatio,
+                                        int defaultSize) {
+  if (bufferSize < 0) bufferSize = defaultSize;
+  if (bufferSize <= higherRatio) return higherRatio;
+  int pow2 = 1;
+  while (pow2 < bufferSize) pow2 <<= 1;
+  return pow2;
+}
+
+int OfflineProcessor::outFrames(int inFrames) const {
+  int inChunk = m_bufferSize / m_method.inRatio;
+  int numChunks = (inFrames + inChunk - 1) / inChunk;
+  return numChunks * (m_bufferSize / m_method.outRatio);
+}
+
+bool OfflineProcessor::prepare() {
+  m_inModel.assign(m_maxBatch * m_method.inSize(m_bufferSize), 0);
+  m_outModel.assign(m_maxBatch * m_method.outSize(m_bufferSize), 0);
+  m_batch = (m_maxBatch > 1 && isStateless()) ? m_maxBatch : 1;
+  return m_backend.bind(m_block, m_method.name,
+                        m_inModel.data(), m_outModel.data(), m_bufferSize, m_batch,
+                        m_method.inDim, m_method.inRatio,
+                        m_method.outDim, m_method.outRatio);
+}
+
+bool OfflineProcessor::isStateless() {
+  PerformBlock block;
+  if (!m_backend.bind(block, m_method.name,
+                      m_inModel.data(), m_outModel.data(), m_bufferSize, 1,
+                      m_method.inDim, m_method.inRatio,
+                      m_method.outDim, m_method.outRatio))
+    return false;
+  // same noise twice: streaming state would change the second output
+  size_t inSize = m_method.inSize(m_bufferSize);
+  size_t outSize = m_method.outSize(m_bufferSize);
+  std::minstd_rand rng(1);
+  std::uniform_real_distribution<float> noise(-1, 1);
+  for (size_t i = 0; i < inSize; ++i) m_inModel[i] = noise(rng);
+
+  m_backend.save_state();
+  m_backend.perform(block);
+  std::vector<float> first(m_outModel.begin(), m_outModel.begin() + outSize);
+  m_backend.perform(block);
+  m_backend.reset_state();
+  return std::equal(first.begin(), first.end(), m_outModel.begin());
+}
+
+// interleaved frames to planar chunks, silent past the end of input
+void OfflineProcessor::readChunks(const float* in, int inFrames,
+                                  int firstChunk, int numChunks) {
+  int dim = m_method.inDim;
+  int chunkFrames = m_bufferSize / m_method.inRatio;
+  size_t chunkSize = m_method.inSize(m_bufferSize);
+  std::fill(m_inModel.begin() + numChunks * chunkSize, m_inModel.end(), 0);
+  for (int k = 0; k < numChunks; ++k) {
+    float* chunk = m_inModel.data() + k * chunkSize;
+    int start = (firstChunk + k) * chunkFrames;
+    int frames = std::clamp(inFrames - start, 0, chunkFrames);
+    const float* src = in + static_cast<size_t>(start) * dim;
+    for (int f = 0; f < frames; ++f, src += dim)
+      for (int c = 0; c < dim; ++c) chunk[c * chunkFrames + f] = src[c];
+    for (int c = 0; c < dim; ++c)
+      std::fill_n(chunk + c * chunkFrames + frames, chunkFrames - frames, 0);
+  }
+}
+
+void OfflineProcessor::writeChunks(float* out, int outFrames,
+                                   int firstChunk, int numChunks) {
+  int dim = m_method.outDim;
+  int chunkFrames = m_bufferSize / m_method.outRatio;
+  size_t chunkSize = m_method.outSize(m_bufferSize);
+  for (int k = 0; k < numChunks; ++k) {
+    const float* chunk = m_outModel.data() + k * chunkSize;
+    int start = (firstChunk + k) * chunkFrames;
+    int frames = std::clamp(outFrames - start, 0, chunkFrames);
+    float* dst = out + static_cast<size_t>(start) * dim;
+    for (int f = 0; f < frames; ++f, dst += dim)
+      for (int c = 0; c < dim; ++c) dst[c] = chunk[c * chunkFrames + f];
+  }
+}
+
+void OfflineProcessor::process(const float* in, int inFrames,
+                               float* out, int outFrames) {
+  int inChunk = m_bufferSize / m_method.inRatio;
+  int numChunks = (inFrames + inChunk - 1) / inChunk;
+  for (int chunk = 0; chunk < numChunks; chunk += m_batch) {
+    int count = std::min(m_batch, numChunks - chunk);
+    readChunks(in, inFrames, chunk, count);
+    m_backend.perform(m_block);
+    writeChunks(out, outFrames, chunk, count);
+  }
+}
+
+} // namespace NN
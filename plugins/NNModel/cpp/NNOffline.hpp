@@ -0,0 +1,55 @@
+// NNOffline.hpp
+
+#pragma once
+#include "NNModel.hpp"
+#include "backend/backend.h"
+#include <vector>
+
+namespace NN {
+
+// run a method over whole signals, as fast as the model goes instead of
+// block by block in real time. Signals are interleaved like SC buffers and
+// sound files, with one frame per model frame: each input frame stands for
+// inRatio samples, each output frame for outRatio samples.
+// Signals are split in chunks of bufferSize samples: stateful methods
+// process them in order on one instance, stateless ones up to maxBatch at
+// once, as a batch.
+class OfflineProcessor {
+public:
+  static constexpr int defaultBufferSize = 65536;
+
+  OfflineProcessor(Backend& backend, const NNModelMethod& method,
+                   int bufferSize, int maxBatch);
+
+  // chunk size for a requested bufferSize: a power of two, at least the
+  // model's higher ratio. Negative for defaultSize, by default much larger
+  // than real-time blocks
+  static int resolveBufferSize(int bufferSize, int higherRatio,
+                               int defaultSize = defaultBufferSize);
+  // number of output frames for inFrames input frames, padded to whole chunks
+  int outFrames(int inFrames) const;
+  // chunks per model pass: 1 for stateful methods
+  int batchSize() const { return m_batch; }
+
+  // bind model blocks and probe statelessness. Returns false on model errors
+  bool prepare();
+  // process inFrames of in into outFrames of out: missing input is silent,
+  // output past outFrames is dropped
+  void process(const float* in, int inFrames, float* out, int outFrames);
+
+private:
+  // whether two passes on the same input give the same output: chunks are
+  // then independent. Leaves model state as it was
+  bool isStateless();
+  void readChunks(const float* in, int inFrames, int firstChunk, int numChunks);
+  void writeChunks(float* out, int outFrames, int firstChunk, int numChunks);
+
+  Backend& m_backend;
+  const NNModelMethod& m_method;
+  int m_bufferSize, m_maxBatch, m_batch;
+  // planar model blocks for a whole batch
+  std::vector<float> m_inModel, m_outModel;
+  PerformBlock m_block;
+};
+
+} // namespace NN
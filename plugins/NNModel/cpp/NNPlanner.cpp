@@ -0,0 +1,80 @@
+// NNPlanner.cpp
+#include "NNPlanner.hpp"
+#include "NNModel.hpp"
+#include "backend/backend.h"
+#include <chrono>
+#include <vector>
+
+namespace NN {
+
+// share of the server block left to a model running on the audio thread,
+// and of its own buffer duration to a model running on a worker
+static constexpr double inlineShare = 0.25;
+static constexpr double threadShare = 0.5;
+static constexpr int measurePasses = 3;
+// larger sizes are only slower: no need to measure past any useful budget
+static constexpr float maxMeasuredMs = 1000;
+
+static double threadBudgetMs(int bufferSize, double sampleRate) {
+  return threadShare * 1000. * bufferSize / sampleRate;
+}
+
+void measureCosts(CostCurve& costs, Backend& backend,
+                  const NNModelMethod& method, int minBufferSize,
+                  int blockSize, double sampleRate) {
+  float prevMsPerSample = 0;
+  for (int k = 0; k < CostCurve::numSizes; ++k) {
+    int bufferSize = minBufferSize << k;
+    std::vector<float> inModel(method.inSize(bufferSize), 0);
+    std::vector<float> outModel(method.outSize(bufferSize), 0);
+    PerformBlock block;
+    if (!backend.bind(block, method.name, inModel.data(), outModel.data(),
+                      bufferSize, 1, method.inDim, method.inRatio,
+                      method.outDim, method.outRatio))
+      break;
+    // first pass includes one-time optimizations
+    backend.perform(block);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < measurePasses; ++i) backend.perform(block);
+    std::chrono::duration<float, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+    float ms = elapsed.count() / measurePasses;
+    costs.setBlockMs(k, ms);
+    if (ms > maxMeasuredMs) break;
+    if (bufferSize < blockSize) continue;
+    // plans take the smallest size that fits: larger ones aren't needed.
+    // A size that misses its budget without being cheaper per sample than
+    // the last one won't be followed by one that fits
+    if (ms <= threadBudgetMs(bufferSize, sampleRate)) break;
+    float msPerSample = ms / bufferSize;
+    if (prevMsPerSample > 0 && msPerSample >= prevMsPerSample) break;
+    prevMsPerSample = msPerSample;
+  }
+  costs.endMeasure();
+}
+
+double inlineBudgetMs(int blockSize, double sampleRate) {
+  return inlineShare * 1000. * blockSize / sampleRate;
+}
+
+Plan makePlan(const CostCurve& costs, int minBufferSize, int blockSize,
+              double sampleRate, int minSize, bool allowInline) {
+  Plan plan{minBufferSize, true};
+  while (plan.bufferSize < blockSize) plan.bufferSize <<= 1;
+  for (int k = 0; k < CostCurve::numSizes; ++k) {
+    int bufferSize = minBufferSize << k;
+    float cost = costs.blockMs(k);
+    if (cost <= 0) break;
+    if (bufferSize < blockSize) continue;
+    plan.bufferSize = bufferSize;
+    if (bufferSize < minSize) continue;
+    // same size, less latency: inline first
+    if (allowInline && cost <= inlineBudgetMs(blockSize, sampleRate))
+      return {bufferSize, false};
+    if (cost <= threadBudgetMs(bufferSize, sampleRate))
+      return {bufferSize, true};
+  }
+  return plan;
+}
+
+} // namespace NN
@@ -0,0 +1,61 @@
+// NNPlanner.hpp
+
+#pragma once
+#include <array>
+#include <atomic>
+
+class Backend;
+
+namespace NN {
+
+class NNModelMethod;
+
+// measured block durations of a method at power of two buffer sizes, from
+// the model's minBufferSize up. Measured once on a loader thread, read by
+// the audio thread when planning
+class CostCurve {
+public:
+  static constexpr int numSizes = 8;
+
+  bool measured() const { return m_state.load(std::memory_order_acquire) == done; }
+  // true for the only caller that should measure
+  bool beginMeasure() {
+    int expected = idle;
+    return m_state.compare_exchange_strong(expected, measuring);
+  }
+  void endMeasure() { m_state.store(done, std::memory_order_release); }
+
+  // block duration at bufferSize minBufferSize << k, 0 if not measured
+  float blockMs(int k) const { return m_blockMs[k].load(std::memory_order_relaxed); }
+  void setBlockMs(int k, float ms) { m_blockMs[k].store(ms, std::memory_order_relaxed); }
+
+private:
+  enum { idle, measuring, done };
+  std::array<std::atomic<float>, numSizes> m_blockMs{};
+  std::atomic<int> m_state{idle};
+};
+
+// time a method at increasing buffer sizes, on an instance of its own,
+// until one holding a server block fits in its worker budget, or until a
+// larger size stops helping. Unmeasured sizes are left at 0
+void measureCosts(CostCurve& costs, Backend& backend,
+                  const NNModelMethod& method, int minBufferSize,
+                  int blockSize, double sampleRate);
+
+struct Plan {
+  int bufferSize;
+  bool useThread;
+};
+
+// time a block can take on the audio thread
+double inlineBudgetMs(int blockSize, double sampleRate);
+
+// smallest buffer size whose blocks fit in their real-time budget, starting
+// from minSize: on the audio thread if a block fits in a share of one server
+// block, on a worker if it fits in a share of its own buffer duration.
+// Falls back to the largest measured size on a worker, or to the smallest
+// one holding a server block if nothing is measured
+Plan makePlan(const CostCurve& costs, int minBufferSize, int blockSize,
+              double sampleRate, int minSize, bool allowInline);
+
+} // namespace NN
@@ -0,0 +1,227 @@
+// NNRemote.cpp
+#include "NNRemote.hpp"
+#include "NNModel.hpp"
+#include <algorithm>
+#include <cstring>
+#ifdef __linux__
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace NN {
+
+namespace Remote {
+
+std::string daemonSegmentName(const char* name) {
+  return std::string("/nn.") + name;
+}
+
+#ifdef __linux__
+
+// not private futexes: waiters and wakers are in different processes
+bool futexWait(Counter& counter, uint32_t expected,
+               std::chrono::nanoseconds timeout) {
+  auto secs = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+  timespec ts{static_cast<time_t>(secs.count()),
+              static_cast<long>((timeout - secs).count())};
+  long res = syscall(SYS_futex, reinterpret_cast<uint32_t*>(&counter),
+                     FUTEX_WAIT, expected, &ts, nullptr, 0);
+  return res == 0 || errno != ETIMEDOUT;
+}
+
+void futexWake(Counter& counter) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&counter),
+          FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+}
+
+void* mapSegment(const std::string& name, size_t& size, bool create) {
+  int flags = create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR;
+  int fd = shm_open(name.c_str(), flags, 0600);
+  if (fd < 0) return nullptr;
+  bool sized;
+  if (create) {
+    // new segments are zeroed
+    sized = ftruncate(fd, size) == 0;
+  } else {
+    struct stat st;
+    sized = fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= size;
+    if (sized) size = st.st_size;
+  }
+  void* segment = sized ? mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fd, 0) : MAP_FAILED;
+  close(fd);
+  if (segment != MAP_FAILED) return segment;
+  if (create) shm_unlink(name.c_str());
+  return nullptr;
+}
+
+void unmapSegment(void* segment, size_t size) {
+  if (segment) munmap(segment, size);
+}
+
+bool isRunning(int pid) {
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+#endif // __linux__
+
+} // namespace Remote
+
+using namespace Remote;
+
+bool RemoteChannel::fail(const char* error) {
+  m_error = error;
+  close();
+  return false;
+}
+
+#ifdef __linux__
+
+bool RemoteChannel::open(const char* daemon, const char* path,
+                         const NNModelMethod& method, int bufferSize,
+                         double blockDuration, int warmup, bool exclusive) {
+  close();
+  size_t daemonSize = sizeof(DaemonSegment);
+  m_daemon = static_cast<DaemonSegment*>(
+    mapSegment(daemonSegmentName(daemon), daemonSize, false));
+  if (m_daemon == nullptr || m_daemon->magic != magic || !isRunning(m_daemon->pid))
+    return fail("daemon not running");
+  if (strlen(path) >= maxPathLength || method.name.size() >= maxNameLength)
+    return fail("model path or method name too long");
+
+  // channel numbers are unique in this process, and process ids on the host
+  static std::atomic<int> s_nextChannel{0};
+  m_segmentName = daemonSegmentName(daemon) + "." + std::to_string(getpid())
+    + "." + std::to_string(s_nextChannel++);
+  int inSize = method.inSize(bufferSize), outSize = method.outSize(bufferSize);
+  m_channelSize = ChannelSegment::size(inSize, outSize);
+  m_channel = static_cast<ChannelSegment*>(mapSegment(m_segmentName, m_channelSize, true));
+  if (m_channel == nullptr) return fail("can't create channel segment");
+  strcpy(m_channel->path, path);
+  strcpy(m_channel->method, method.name.c_str());
+  m_channel->bufferSize = bufferSize;
+  m_channel->inSize = inSize;
+  m_channel->outSize = outSize;
+  m_channel->warmup = warmup;
+  m_channel->blockDuration = blockDuration;
+  m_channel->exclusive = exclusive;
+
+  for (auto& entry: m_daemon->channels) {
+    uint32_t expected = channelFree;
+    if (entry.state.compare_exchange_strong(expected, channelClaimed)) {
+      m_entry = &entry;
+      break;
+    }
+  }
+  if (m_entry == nullptr) return fail("too many channels");
+  strcpy(m_entry->segment, m_segmentName.c_str());
+  m_entry->clientPid = getpid();
+  m_entry->state.store(channelRequested, std::memory_order_release);
+  m_daemon->requests.fetch_add(1);
+  futexWake(m_daemon->requests);
+
+  // the daemon may be loading the model: check that it's still there
+  // every now and then
+  auto deadline = std::chrono::steady_clock::now() + openTimeout;
+  uint32_t state;
+  while ((state = m_entry->state.load(std::memory_order_acquire)) == channelRequested) {
+    auto left = deadline - std::chrono::steady_clock::now();
+    if (left <= left.zero() || !isRunning(m_daemon->pid))
+      return fail("daemon didn't answer");
+    futexWait(m_entry->state, channelRequested,
+              std::min<std::chrono::nanoseconds>(left, std::chrono::milliseconds(200)));
+  }
+  if (state != channelOpen) return fail("daemon couldn't load model method");
+  m_submitted = m_channel->completed.load();
+  return true;
+}
+
+void RemoteChannel::close() {
+  if (m_entry) {
+    // the daemon frees entries it knows about, others are freed here. The
+    // daemon may change the state meanwhile: a failed exchange reloads it
+    uint32_t state = m_entry->state.load();
+    while (true) {
+      if (state != channelRequested && state != channelOpen) {
+        m_entry->state.store(channelFree);
+        break;
+      }
+      if (m_entry->state.compare_exchange_weak(state, channelClosing)) {
+        m_daemon->requests.fetch_add(1);
+        futexWake(m_daemon->requests);
+        break;
+      }
+    }
+    m_entry = nullptr;
+  }
+  if (m_channel) {
+    // the daemon keeps its own mapping until it drops the channel
+    unmapSegment(m_channel, m_channelSize);
+    shm_unlink(m_segmentName.c_str());
+    m_channel = nullptr;
+  }
+  unmapSegment(m_daemon, sizeof(DaemonSegment));
+  m_daemon = nullptr;
+}
+
+bool RemoteChannel::setAttribute(const char* name, double value) {
+  if (!m_channel) return false;
+  int n = m_channel->numAttributes;
+  if (n >= maxAttributes || strlen(name) >= maxNameLength) return false;
+  strcpy(m_channel->attributes[n].name, name);
+  m_channel->attributes[n].value = value;
+  m_channel->numAttributes = n + 1;
+  return true;
+}
+
+bool RemoteChannel::perform(const float* in, float* out) {
+  if (!m_channel) return false;
+  memcpy(m_channel->inModel(), in, m_channel->inSize * sizeof(float));
+  uint32_t block = ++m_submitted;
+  m_channel->submitted.store(block, std::memory_order_release);
+  auto& doorbell = m_daemon->doorbells[m_entry->group];
+  doorbell.fetch_add(1, std::memory_order_release);
+  futexWake(doorbell);
+
+  // the daemon may have stopped: check that it's still there every now and
+  // then. On failures the channel is closed, so that the daemon doesn't
+  // process a block while the next one is copied in
+  auto deadline = std::chrono::steady_clock::now() + performTimeout;
+  uint32_t done;
+  while ((done = m_channel->completed.load(std::memory_order_acquire)) != block) {
+    auto left = deadline - std::chrono::steady_clock::now();
+    if (left <= left.zero())
+      return fail("daemon didn't process block in time");
+    if (!isRunning(m_daemon->pid) ||
+        m_entry->state.load(std::memory_order_acquire) != channelOpen)
+      return fail("daemon stopped");
+    futexWait(m_channel->completed, done,
+              std::min<std::chrono::nanoseconds>(left, std::chrono::milliseconds(50)));
+  }
+  memcpy(out, m_channel->outModel(), m_channel->outSize * sizeof(float));
+  // attributes were applied with this block
+  m_channel->numAttributes = 0;
+  return true;
+}
+
+#else
+
+bool RemoteChannel::open(const char*, const char*, const NNModelMethod&,
+                         int, double, int, bool) {
+  return fail("nn_daemon is only supported on Linux");
+}
+
+void RemoteChannel::close() {}
+bool RemoteChannel::setAttribute(const char*, double) { return false; }
+bool RemoteChannel::perform(const float*, float*) { return false; }
+
+#endif // __linux__
+
+} // namespace NN
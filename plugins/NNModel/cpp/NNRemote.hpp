@@ -0,0 +1,156 @@
+// NNRemote.hpp
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace NN {
+
+class NNModelMethod;
+
+// shared memory protocol between servers and nn_daemon, a local process
+// that holds each model once and batches blocks from all servers.
+// No sockets: the daemon creates a segment named after it, with a table of
+// channels. Each UGen instance opens a channel: a segment of its own with
+// its model blocks, that it registers in the table. Blocks are handed over
+// by bumping counters, and waited on with futexes on them (Linux only)
+namespace Remote {
+
+constexpr uint32_t magic = 0x4e4e4431; // "NND1"
+constexpr int maxChannels = 256;
+// daemon threads, each running a model instance for one channel, or for
+// several channels batching a stateless method
+constexpr int maxGroups = maxChannels;
+constexpr int maxAttributes = 16;
+constexpr size_t maxPathLength = 1024;
+constexpr size_t maxNameLength = 64;
+
+using Counter = std::atomic<uint32_t>;
+static_assert(sizeof(Counter) == sizeof(uint32_t) && Counter::is_always_lock_free,
+              "futexes need plain 32-bit atomics");
+
+enum ChannelState : uint32_t {
+  // claimed by a client, then requested once filled
+  channelFree = 0, channelClaimed, channelRequested,
+  // set by the daemon: channel is in a group, or couldn't be opened
+  channelOpen, channelFailed,
+  // set by the client: the daemon frees the entry
+  channelClosing
+};
+
+// entry in the daemon's table
+struct ChannelEntry {
+  Counter state;
+  // futex of the group processing this channel, set when open
+  int32_t group;
+  int32_t clientPid;
+  char segment[maxNameLength];
+};
+
+// daemon segment: /nn.<name>
+struct DaemonSegment {
+  uint32_t magic;
+  int32_t pid;
+  // bumped by clients when they change an entry's state
+  Counter requests;
+  // bumped by clients when they submit a block to a group
+  Counter doorbells[maxGroups];
+  ChannelEntry channels[maxChannels];
+};
+
+// attribute value for the next block
+struct AttributeValue {
+  char name[maxNameLength];
+  double value;
+};
+
+// channel segment: /nn.<name>.<pid>.<n>, followed by inSize and outSize
+// floats of model blocks
+struct ChannelSegment {
+  char path[maxPathLength];
+  char method[maxNameLength];
+  int32_t bufferSize, inSize, outSize, warmup;
+  // server block duration: how long the daemon waits for other channels
+  // of a group before processing a batch
+  double blockDuration;
+  // set for UGens with attributes: their model instance is their own, so
+  // that setting attributes doesn't change other channels
+  int32_t exclusive;
+  // blocks submitted by the client, and completed by the daemon
+  Counter submitted, completed;
+  int32_t numAttributes;
+  AttributeValue attributes[maxAttributes];
+
+  float* inModel() { return reinterpret_cast<float*>(this + 1); }
+  float* outModel() { return inModel() + inSize; }
+  static size_t size(int inSize, int outSize) {
+    return sizeof(ChannelSegment) + sizeof(float) * (inSize + outSize);
+  }
+};
+
+std::string daemonSegmentName(const char* name);
+
+// wait until counter isn't expected anymore, or timeout. Returns false on
+// timeout
+bool futexWait(Counter& counter, uint32_t expected,
+               std::chrono::nanoseconds timeout);
+void futexWake(Counter& counter);
+
+// map a shared memory segment, creating it with size if create is set.
+// Otherwise maps the whole segment, setting size, which must be at least as
+// large. Returns nullptr on errors
+void* mapSegment(const std::string& name, size_t& size, bool create);
+void unmapSegment(void* segment, size_t size);
+// whether a server or daemon process is still there
+bool isRunning(int pid);
+
+} // namespace Remote
+
+// a UGen instance's connection to nn_daemon. Blocks are processed on the
+// daemon: perform hands one over and waits for it, so that it's called by
+// workers, never on the audio thread
+class RemoteChannel {
+public:
+  RemoteChannel() = default;
+  RemoteChannel(const RemoteChannel&) = delete;
+  RemoteChannel& operator=(const RemoteChannel&) = delete;
+  ~RemoteChannel() { close(); }
+
+  // register a channel for a method of the model at path, waiting for the
+  // daemon to load it. Returns false if the daemon isn't running, or
+  // couldn't load the model
+  bool open(const char* daemon, const char* path, const NNModelMethod& method,
+            int bufferSize, double blockDuration, int warmup, bool exclusive);
+  void close();
+  bool isOpen() const { return m_channel != nullptr; }
+  // why open or perform failed
+  const char* error() const { return m_error; }
+
+  // attribute values for the next block: false if there are too many
+  bool setAttribute(const char* name, double value);
+  // process a block of planar model frames. Returns false, leaving out
+  // unchanged, if the channel isn't open. If the daemon stopped or didn't
+  // answer in time, the channel is closed
+  bool perform(const float* in, float* out);
+
+  // how long open waits for the daemon to load a model, and perform for a
+  // block to be processed
+  static constexpr std::chrono::seconds openTimeout{60};
+  static constexpr std::chrono::seconds performTimeout{2};
+
+private:
+  bool fail(const char* error);
+
+  Remote::DaemonSegment* m_daemon = nullptr;
+  Remote::ChannelSegment* m_channel = nullptr;
+  Remote::ChannelEntry* m_entry = nullptr;
+  std::string m_segmentName;
+  size_t m_channelSize = 0;
+  uint32_t m_submitted = 0;
+  const char* m_error = "";
+};
+
+} // namespace NN
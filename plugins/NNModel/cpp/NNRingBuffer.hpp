@@ -0,0 +1,163 @@
+// NNRingBuffer.hpp
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#ifdef NOVA_SIMD
+#include "simd_memory.hpp"
+#endif
+
+namespace NN {
+
+// multichannel ring buffer of model frames, on already allocated planar
+// memory, so that it can live on the real-time pool. All channels share the
+// same positions. Capacity is a power of two, for bitmask wrapping: it holds
+// up to size frames per channel, and writing more drops the oldest ones.
+// With a ratio, audio is decimated on write, keeping the last sample of each
+// ratio samples, and frames are held for ratio samples on read. Samples are
+// audio samples or control periods, depending on the caller's rate
+class RingBuf {
+public:
+  // data: numChannels * capacity(size) frames
+  RingBuf(float* data, int numChannels, int size, int ratio = 1):
+    m_data(data), m_numChannels(numChannels), m_size(size), m_ratio(ratio),
+    m_capacity(capacity(size)), m_mask(m_capacity - 1) {}
+
+  static int capacity(int size) {
+    int pow2 = 1;
+    while (pow2 < size) pow2 <<= 1;
+    return pow2;
+  }
+
+  float* getBuffer() const { return m_data; }
+  int readable() const { return static_cast<int>(m_written - m_read); }
+  bool full() const { return readable() == m_size; }
+  bool empty() const { return m_written == m_read; }
+  void reset() { m_read = m_written; }
+
+  // audio side: write N samples per channel, from one buffer per channel
+  void put(const float* const* channels, int N) {
+    put(channels, N, [](int) { return 1; });
+  }
+  // step(c) is 0 for channels holding a single value for all N samples,
+  // such as control-rate inputs of an audio-rate unit
+  template <class ChannelStep>
+  void put(const float* const* channels, int N, ChannelStep step) {
+    writeAudio([channels](int c) { return channels[c]; }, step, N);
+  }
+  void putSilence(int N) {
+    writeAudio([](int) { return static_cast<const float*>(nullptr); },
+               [](int) { return 1; }, N);
+  }
+  // audio side: read N samples per channel, silent if no frames are available
+  void get(float* const* channels, int N) {
+    if (m_ratio == 1) {
+      read([channels](int c) { return channels[c]; }, N);
+      return;
+    }
+    for (int n = 0; n < N;) {
+      int count = std::min(m_ratio - m_getPhase, N - n);
+      bool available = !empty();
+      int pos = m_read & m_mask;
+      for (int c = 0; c < m_numChannels; ++c) {
+        float value = available ? m_data[c * m_capacity + pos] : 0;
+        std::fill_n(channels[c] + n, count, value);
+      }
+      n += count;
+      m_getPhase += count;
+      if (m_getPhase == m_ratio) {
+        m_getPhase = 0;
+        if (available) ++m_read;
+      }
+    }
+  }
+
+  // model side: write N frames per channel, from a planar buffer with
+  // channels stride frames apart
+  void put(const float* planar, int stride, int N) {
+    write([planar, stride](int c) { return planar + c * stride; },
+          [](int) { return 1; }, N, 1);
+  }
+  void get(float* planar, int stride, int N) {
+    read([planar, stride](int c) { return planar + c * stride; }, N);
+  }
+
+private:
+  static void copy(float* dst, const float* src, int n, int step) {
+    if (n <= 0) return;
+    if (src == nullptr) {
+      memset(dst, 0, n * sizeof(float));
+    } else if (step == 0) {
+      std::fill_n(dst, n, *src);
+    } else if (step > 1) {
+      for (int i = 0; i < n; ++i) dst[i] = src[i * step];
+#ifdef NOVA_SIMD
+    } else if ((n & 15) == 0) {
+      nova::copyvec_nn_simd(dst, src, n);
+#endif
+    } else {
+      memcpy(dst, src, n * sizeof(float));
+    }
+  }
+
+  // decimate: write the samples that end a frame
+  template <class ChannelSrc, class ChannelStep>
+  void writeAudio(ChannelSrc channel, ChannelStep step, int N) {
+    if (m_ratio == 1) {
+      write(channel, step, N, 1);
+      return;
+    }
+    int first = m_ratio - 1 - m_putPhase;
+    int frames = first < N ? (N - 1 - first) / m_ratio + 1 : 0;
+    m_putPhase = (m_putPhase + N) % m_ratio;
+    write([&channel, &step, first](int c) {
+      const float* src = channel(c);
+      return src ? src + first * step(c) : nullptr;
+    }, step, frames, m_ratio);
+  }
+
+  // each transfer is at most two chunks per channel: before and after wrap.
+  // Channels advance by frameStep times their own step per frame
+  template <class ChannelSrc, class ChannelStep>
+  void write(ChannelSrc channel, ChannelStep channelStep, int N, int frameStep) {
+    int skip = std::max(0, N - m_size);
+    N -= skip;
+    int pos = m_written & m_mask;
+    int first = std::min(N, m_capacity - pos);
+    for (int c = 0; c < m_numChannels; ++c) {
+      const float* src = channel(c);
+      int step = channelStep(c) * frameStep;
+      if (src) src += skip * step;
+      float* dst = m_data + c * m_capacity;
+      copy(dst + pos, src, first, step);
+      copy(dst, src ? src + first * step : nullptr, N - first, step);
+    }
+    m_written += N;
+    if (readable() > m_size) m_read = m_written - m_size;
+  }
+
+  template <class ChannelDst> void read(ChannelDst channel, int N) {
+    int available = std::min(readable(), N);
+    int pos = m_read & m_mask;
+    int first = std::min(available, m_capacity - pos);
+    for (int c = 0; c < m_numChannels; ++c) {
+      const float* src = m_data + c * m_capacity;
+      float* dst = channel(c);
+      copy(dst, src + pos, first, 1);
+      copy(dst + first, src, available - first, 1);
+      copy(dst + available, nullptr, N - available, 1);
+    }
+    m_read += available;
+  }
+
+  float* m_data;
+  int m_numChannels, m_size, m_ratio, m_capacity, m_mask;
+  // total frames written and read per channel: positions are masked
+  uint64_t m_written = 0, m_read = 0;
+  // audio samples into the frame being written and read
+  int m_putPhase = 0, m_getPhase = 0;
+};
+
+} // namespace NN
@@ -0,0 +1,46 @@
+// NNSpscQueue.hpp
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace NN {
+
+// lock-free queue between one producer and one consumer thread, with fixed
+// capacity: no allocation nor waiting on push and pop.
+// Indices are sequentially consistent, so that a producer can publish an
+// item and then check a flag, while the consumer clears the flag and then
+// checks for items, without both missing each other
+template <class T, size_t Capacity> class SpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "SpscQueue capacity must be a power of two");
+
+public:
+  // producer thread
+  bool push(const T& item) {
+    size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load() == Capacity) return false;
+    m_items[head & (Capacity - 1)] = item;
+    m_head.store(head + 1);
+    return true;
+  }
+
+  // consumer thread
+  bool pop(T& item) {
+    size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail == m_head.load()) return false;
+    item = m_items[tail & (Capacity - 1)];
+    m_tail.store(tail + 1);
+    return true;
+  }
+
+  bool empty() const { return m_head.load() == m_tail.load(); }
+
+private:
+  std::array<T, Capacity> m_items;
+  std::atomic<size_t> m_head{0};
+  std::atomic<size_t> m_tail{0};
+};
+
+} // namespace NN
@@ -0,0 +1,120 @@
+// NNStats.cpp
+#include "NNStats.hpp"
+#include "NNModel.hpp"
+#include <algorithm>
+
+namespace NN {
+
+void Histogram::record(StatsClock::duration duration) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+  uint64_t value = us > 0 ? us : 0;
+  int bucket = 0;
+  while (bucket < numBuckets - 1 && (uint64_t(1) << bucket) < value) ++bucket;
+  m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  m_sumUs.fetch_add(value, std::memory_order_relaxed);
+  uint64_t max = m_maxUs.load(std::memory_order_relaxed);
+  while (value > max &&
+         !m_maxUs.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+}
+
+void Histogram::reset() {
+  for (auto& b: m_buckets) b.store(0, std::memory_order_relaxed);
+  m_count = 0;
+  m_sumUs = 0;
+  m_maxUs = 0;
+}
+
+double Histogram::quantileMs(uint64_t count, double q) const {
+  uint64_t target = static_cast<uint64_t>(q * count);
+  uint64_t seen = 0;
+  for (int i = 0; i < numBuckets; ++i) {
+    seen += m_buckets[i].load(std::memory_order_relaxed);
+    if (seen > target) return (uint64_t(1) << i) / 1000.;
+  }
+  return m_maxUs.load(std::memory_order_relaxed) / 1000.;
+}
+
+void Histogram::stream(std::ostream& dest, int indent) const {
+  std::string pad(indent, ' ');
+  uint64_t count = m_count.load(std::memory_order_relaxed);
+  dest << "\n" << pad << "count: " << count;
+  if (count == 0) return;
+  dest << "\n" << pad << "meanMs: " << m_sumUs.load(std::memory_order_relaxed) / 1000. / count
+    << "\n" << pad << "p50Ms: " << quantileMs(count, 0.5)
+    << "\n" << pad << "p99Ms: " << quantileMs(count, 0.99)
+    << "\n" << pad << "maxMs: " << m_maxUs.load(std::memory_order_relaxed) / 1000.
+    << "\n" << pad << "bucketsUs:";
+  // only non-empty buckets, by upper bound
+  for (int i = 0; i < numBuckets; ++i) {
+    uint64_t n = m_buckets[i].load(std::memory_order_relaxed);
+    if (n > 0) dest << "\n" << pad << "  " << (uint64_t(1) << i) << ": " << n;
+  }
+}
+
+void NNStats::reset() {
+  inference.reset();
+  attributes.reset();
+  queueWait.reset();
+  blocks = 0;
+  missedHandoffs = 0;
+}
+
+NNStats* StatsRegistry::claim(int nodeID, int modelIdx, int methodIdx, int bufferSize) {
+  for (auto& slot: m_slots) {
+    bool used = false;
+    if (!slot.used.compare_exchange_strong(used, true, std::memory_order_acquire))
+      continue;
+    slot.nodeID = nodeID;
+    slot.modelIdx = modelIdx;
+    slot.methodIdx = methodIdx;
+    slot.bufferSize = bufferSize;
+    slot.stats.reset();
+    slot.ready.store(true, std::memory_order_release);
+    return &slot.stats;
+  }
+  return &m_overflow;
+}
+
+void StatsRegistry::release(NNStats* stats) {
+  if (stats == &m_overflow) return;
+  for (auto& slot: m_slots) {
+    if (&slot.stats != stats) continue;
+    slot.ready.store(false, std::memory_order_relaxed);
+    slot.used.store(false, std::memory_order_release);
+    return;
+  }
+}
+
+void StatsRegistry::stream(std::ostream& dest, const NNModelDescLib& models,
+                           double sampleRate) const {
+  for (const auto& slot: m_slots) {
+    if (!slot.ready.load(std::memory_order_acquire)) continue;
+    auto model = models.get(slot.modelIdx, false);
+    auto method = model ? model->getMethod(slot.methodIdx, false) : nullptr;
+    const auto& stats = slot.stats;
+    dest << "- node: " << slot.nodeID
+      << "\n  model: " << slot.modelIdx;
+    if (model) dest << "\n  modelPath: " << model->getPath();
+    if (method) dest << "\n  method: " << method->name;
+    dest << "\n  bufferSize: " << slot.bufferSize
+      // time available for each block in real time
+      << "\n  budgetMs: " << slot.bufferSize * 1000. / sampleRate
+      << "\n  blocks: " << stats.blocks.load(std::memory_order_relaxed)
+      << "\n  missedHandoffs: " << stats.missedHandoffs.load(std::memory_order_relaxed)
+      << "\n  inference:";
+    stats.inference.stream(dest, 4);
+    dest << "\n  attributes:";
+    stats.attributes.stream(dest, 4);
+    dest << "\n  queueWait:";
+    stats.queueWait.stream(dest, 4);
+    dest << "\n";
+  }
+}
+
+void StatsRegistry::reset() {
+  for (auto& slot: m_slots)
+    if (slot.ready.load(std::memory_order_acquire)) slot.stats.reset();
+}
+
+} // namespace NN
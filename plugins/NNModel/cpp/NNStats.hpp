@@ -0,0 +1,92 @@
+// NNStats.hpp
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+namespace NN {
+
+class NNModelDescLib;
+
+using StatsClock = std::chrono::steady_clock;
+
+// lock-free histogram of durations, in power of two buckets of microseconds:
+// bucket i counts durations up to 2^i us. Recording is wait-free, so it can
+// stay on in production, and from the audio thread
+class Histogram {
+public:
+  static constexpr int numBuckets = 24;
+
+  void record(StatsClock::duration duration);
+  void reset();
+  // YAML map, indented by indent spaces
+  void stream(std::ostream& dest, int indent) const;
+
+private:
+  // upper bound of the bucket where the q-th quantile falls, in ms
+  double quantileMs(uint64_t count, double q) const;
+
+  std::array<std::atomic<uint64_t>, numBuckets> m_buckets{};
+  std::atomic<uint64_t> m_count{0}, m_sumUs{0}, m_maxUs{0};
+};
+
+// timings of one NN instance
+struct NNStats {
+  // model perform, alone
+  Histogram inference;
+  // setting attributes before perform
+  Histogram attributes;
+  // from handing a block over to workers, until perform starts
+  Histogram queueWait;
+  // blocks handed over to workers, or processed inline
+  std::atomic<uint64_t> blocks{0};
+  // full input buffers that couldn't be handed over because the
+  // previous result wasn't ready: their block is skipped
+  std::atomic<uint64_t> missedHandoffs{0};
+
+  void reset();
+};
+
+// time since a start point, recorded into a histogram on destruction
+class ScopedTimer {
+public:
+  ScopedTimer(Histogram& histogram):
+    m_histogram(histogram), m_start(StatsClock::now()) {}
+  ~ScopedTimer() { m_histogram.record(StatsClock::now() - m_start); }
+
+private:
+  Histogram& m_histogram;
+  StatsClock::time_point m_start;
+};
+
+// fixed table of stats for live instances, never freed, so that /nn_stats
+// can read them while instances come and go, without locks
+class StatsRegistry {
+public:
+  static constexpr int maxInstances = 1024;
+
+  // audio thread: claim the first free slot for an instance. When the table
+  // is full, returns a shared slot that is never reported
+  NNStats* claim(int nodeID, int modelIdx, int methodIdx, int bufferSize);
+  void release(NNStats* stats);
+
+  // NRT thread: YAML list of live instances, one per entry
+  void stream(std::ostream& dest, const NNModelDescLib& models,
+              double sampleRate) const;
+  void reset();
+
+private:
+  struct Slot {
+    // claimed by an instance, and published with its fields set
+    std::atomic<bool> used{false}, ready{false};
+    int nodeID = 0, modelIdx = 0, methodIdx = 0, bufferSize = 0;
+    NNStats stats;
+  };
+  std::array<Slot, maxInstances> m_slots;
+  NNStats m_overflow;
+};
+
+} // namespace NN
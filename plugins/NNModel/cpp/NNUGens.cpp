@@ -1,17 +1,76 @@
 // NNUGens.cpp
 #include "NNModel.hpp"
 #include "NNUGens.hpp"
+#include "NNBatch.hpp"
+#include "NNBackendPool.hpp"
+#include "NNWorkerPool.hpp"
+#include "NNLoader.hpp"
 #include "NNModelCmd.hpp"
 #include "SC_Unit.h"
-#include "rt_circular_buffer.h"
 #include "SC_InterfaceTable.h"
 #include "SC_PlugIn.hpp"
+#include <algorithm>
+#include <bit>
 #include <chrono>
+#include <thread>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 InterfaceTable* ft;
 
+// perform workers share the cores: without a model or /nn_threads setting,
+// each runs with its share of intra-op threads, rather than with libtorch's
+// default of all cores
+static int workerNumThreads() {
+  int cores = std::max(1u, std::thread::hardware_concurrency());
+  return std::max(1, cores / NN::WorkerPool::resolveNumWorkers(0));
+}
+
+static void initWorkerThread() {
+  Backend::set_thread_num_threads(workerNumThreads());
+}
+
+// background threads run with the same thread count, at a lower priority
+// than workers
+static void initBackgroundThread() {
+  initWorkerThread();
+#ifdef __linux__
+  setpriority(PRIO_PROCESS, syscall(SYS_gettid), 10);
+#endif
+}
+
+static void requestCollect();
 // global model store, by numeric id
-NN::NNModelDescLib gModels;
+NN::NNModelDescLib gModels(requestCollect);
+// loaded and warmed up model instances
+NN::BackendPool gBackendPool;
+// threads running perform jobs, started with the loader
+NN::WorkerPool gWorkers(0, initWorkerThread);
+// threads running jobs that take a while, off the workers: model loads and
+// warmups, batch joins and teardown
+NN::WorkerPool gBackground(std::max(2u, std::thread::hardware_concurrency() / 4),
+                           initBackgroundThread);
+// timings of live instances
+NN::StatsRegistry gStats;
+// threads loading and unloading models, off the NRT command thread.
+// Started by the first command that needs them, on real-time servers only
+NN::ModelLoader gLoader;
+
+static void collect_job(void*) { gModels.collectRetired(); }
+static void submit_collect_job(void*) { gLoader.submit(-1, {collect_job, nullptr}); }
+
+// a replaced or unloaded model may be unused: freed on the loader, through
+// a background thread since the audio thread can't submit to the loader.
+// These are only started on real-time servers: others free it right away
+static void requestCollect() {
+  if (!gBackground.isStarted())
+    gModels.collectRetired();
+  else
+    gBackground.submit({submit_collect_job, nullptr});
+}
 
 
 template<class T>
@@ -36,42 +95,53 @@ void NNUGen::clearOutputs(int nSamples) {
 
 // ATTRIBUTES
 NNSetAttr::NNSetAttr(const NNModelAttribute* attr, int inputIdx, float initVal):
-    attr(attr), inputIdx(inputIdx), value(initVal), valUpdated(true) {}
+    attr(attr), inputIdx(inputIdx), lastValue(initVal),
+    value(initVal), valUpdated(true) {}
 
 void NNSetAttr::update(Unit* unit, int nSamples) {
   float newval = IN0(inputIdx);
-  if (newval != value) {
-    value = newval;
-    valUpdated = true;
+  if (newval != lastValue) {
+    lastValue = newval;
+    value.store(newval, std::memory_order_relaxed);
+    valUpdated.store(true, std::memory_order_release);
   }
 }
 
 // attributes are provided as additional input pairs (attrId, val) after model inputs
-void NNUGen::setupAttributes() {
+int NNUGen::maxAttributes() {
+  return std::max(0, numInputs() - UGenInputs::inputs - m_inDim) / 2;
+}
+
+// attributes: room for maxAttributes() setters
+void NNUGen::setupAttributes(NN* nn, NNSetAttr* attributes) {
+  int count = 0;
   int i = UGenInputs::inputs + m_inDim;
-  while (i < numInputs()) {
+  while (i + 1 < numInputs()) {
     int attrIdx = in0(i);
-    auto attr = m_sharedData->m_modelDesc->getAttribute(attrIdx, true);
+    auto attr = nn->m_modelDesc->getAttribute(attrIdx, true);
     if (attr != nullptr) {
       int inputIdx = i + 1;
-      NNSetAttr setter(attr, inputIdx, in0(inputIdx));
-      m_sharedData->m_attributes.push_back(setter);
+      new(attributes + count++) NNSetAttr(attr, inputIdx, in0(inputIdx));
     } else {
       Print("NNUGen: attribute #%d not found\n", attrIdx);
     }
     i += 2; // attrIdx, val
   }
+  nn->m_attributes = std::span<NNSetAttr>(attributes, count);
 }
 
-static void model_perform_attributes(NN* nn_instance) {
+void model_perform_attributes(NN* nn_instance, Backend& backend) {
   for(auto& attr: nn_instance->m_attributes) {
-    if (!attr.changed()) continue;
+    float value;
+    if (!attr.consume(value)) continue;
     const char* attrName = attr.getName();
     try {
-      nn_instance->m_model.set_attribute(attrName, {attr.getStrValue()});
+      if (!attr.setter.is_bound() && !backend.bind_attribute(attr.setter, attrName))
+        throw "setter not found";
+      backend.set_attribute(attr.setter, value);
       // print attr value if debugging
       if (nn_instance->m_debug >= Debug::attributes) {
-        auto currVal = nn_instance->m_model.get_attribute_as_string(attrName);
+        auto currVal = backend.get_attribute_as_string(attrName);
         Print("%s: %s\n", attrName, currVal.c_str());
       }
     } catch (...) {
@@ -82,75 +152,295 @@ static void model_perform_attributes(NN* nn_instance) {
 
 // PERFORM
 
-void model_perform_load(NN* nn, int warmup) {
-  auto path = nn->m_modelDesc->getPath();
+// the daemon loads the model, or shares it with other servers
+static void model_perform_connect(NN* nn, int warmup) {
+  auto desc = nn->m_modelDesc;
+  auto remote = new RemoteChannel();
+  double blockDuration = nn->mWorld->mFullRate.mBufDuration;
+  // attributes are set on the UGen's own instance
+  bool exclusive = !nn->m_attributes.empty();
+  if (!remote->open(desc->getRemote(), desc->getPath(), *nn->m_method,
+                    nn->m_bufferSize, blockDuration, warmup, exclusive)) {
+    Print("NNUGen: ERROR can't run %s on nn_daemon %s: %s\n",
+          desc->getPath(), desc->getRemote(), remote->error());
+    delete remote;
+    return;
+  }
+  nn->m_remote = remote;
+  nn->m_loaded = true;
   if (nn->m_debug >= Debug::all)
-    Print("NNUGen: loading model %s\n", path);
-  int err = nn->m_model.load(path);
-  if (err) {
-    Print("NNUGen: ERROR loading model %s\n", path);
+    Print("NNUGen: connected to nn_daemon %s\n", desc->getRemote());
+}
+
+void model_perform_load(NN* nn, int warmup) {
+  if (nn->m_modelDesc->isRemote()) {
+    model_perform_connect(nn, warmup);
     return;
   }
-  if (warmup > 0) {
+  auto path = nn->m_modelDesc->getPath();
+  // instances from the pool are already loaded and warm
+  bool pooled = nn->m_model != nullptr;
+  if (!pooled) {
+    if (nn->m_debug >= Debug::all)
+      Print("NNUGen: loading model %s\n", path);
+    nn->m_model = new Backend();
+    // share weights with the model loaded by NNModelDesc
+    auto shared = nn->m_modelDesc->getBackend();
+    int err = shared ? nn->m_model->load(*shared) : nn->m_model->load(path);
+    if (err) {
+      Print("NNUGen: ERROR loading model %s\n", path);
+      return;
+    }
+  }
+  auto method = nn->m_method;
+  nn->m_model->set_num_threads(nn->m_modelDesc->getThreads(method));
+  for (int slot = 0; slot < nn->m_depth; ++slot) {
+    if (!nn->m_model->bind(nn->m_blocks[slot], method->name,
+                           nn->inModel(slot), nn->outModel(slot), nn->m_bufferSize, 1,
+                           method->inDim, method->inRatio,
+                           method->outDim, method->outRatio)) {
+      Print("NNUGen: ERROR method %s not found in %s\n", method->name.c_str(), path);
+      return;
+    }
+  }
+  if (!pooled && warmup > 0) {
     if (nn->m_debug >= Debug::all)
       Print("NNUGen: warming up model\n", path);
     nn->warmupModel(warmup);
   }
   nn->m_loaded = true;
   if (nn->m_debug >= Debug::all)
-    Print("NNUGen: loaded %s\n", path);
+    Print("NNUGen: loaded %s%s\n", path, pooled ? " (from pool)" : "");
 }
 
-void model_perform_cleanup(NN* nn_instance) {
+// instances released by other threads, whose real-time memory waits for the audio
+// thread: RTFree isn't thread-safe
+static std::atomic<NN*> gReleased{nullptr};
+// instances whose cleanup job couldn't be queued, retried by the audio thread
+static std::atomic<NN*> gOrphans{nullptr};
+// instances whose load or join job couldn't be queued, retried by the audio
+// thread. Each holds the reference taken for its job
+static std::atomic<NN*> gPendingStarts{nullptr};
+
+static void pushInstance(std::atomic<NN*>& list, NN* nn) {
+  nn->m_nextInList = list.load();
+  while (!list.compare_exchange_weak(nn->m_nextInList, nn)) {}
+}
+
+static void model_free(NN* nn_instance) {
   auto mWorld = nn_instance->mWorld;
   // manually call destructor and free instance
   nn_instance->~NN();
   RTFree(mWorld, nn_instance);
 }
 
-void model_perform(NN* nn_instance) {
-  /* Timer timer; */
-  std::vector<float *> in_model, out_model;
-  for (int c(0); c < nn_instance->m_inDim; ++c)
-    in_model.push_back(&nn_instance->m_inModel[nn_instance->m_bufferSize * c]);
-  for (int c(0); c < nn_instance->m_outDim; ++c)
-    out_model.push_back(&nn_instance->m_outModel[nn_instance->m_bufferSize * c]);
-  model_perform_attributes(nn_instance);
-  /* timer.print("attrs:"); */
-  nn_instance->m_model.perform(in_model, out_model,
-                               nn_instance->m_bufferSize,
-                               nn_instance->m_method->name, 1);
-  /* timer.print("perform:"); */
-}
-
-
-void model_perform_loop(NN *nn_instance, int warmup) {
-  model_perform_load(nn_instance, warmup);
-  std::vector<float *> in_model, out_model;
-  for (int c(0); c < nn_instance->m_inDim; ++c)
-    in_model.push_back(&nn_instance->m_inModel[nn_instance->m_bufferSize * c]);
-  for (int c(0); c < nn_instance->m_outDim; ++c)
-    out_model.push_back(&nn_instance->m_outModel[nn_instance->m_bufferSize * c]);
-  while (!nn_instance->m_should_stop_perform_thread) {
-    if (nn_instance->m_data_available_lock.try_acquire_for(
-      std::chrono::milliseconds(200))) {
-        /* nn_instance->timer.print("received in:"); */
-        model_perform_attributes(nn_instance);
-        /* Timer timer; */
-        nn_instance->m_model.perform(in_model, out_model,
-                                     nn_instance->m_bufferSize,
-                                     nn_instance->m_method->name, 1);
-        /* timer.print("model perform:"); */
-      nn_instance->m_result_available_lock.release();
+// off the audio thread: release the model, and hand the rest back
+void model_perform_cleanup(NN* nn_instance) {
+  nn_instance->releaseModel();
+  pushInstance(gReleased, nn_instance);
+}
+
+// attributes go with the block, and are set by the daemon
+// failed channels stay closed: their UGens output silence
+static void model_perform_remote(NN* nn_instance, int slot) {
+  auto remote = nn_instance->m_remote;
+  float* out = nn_instance->outModel(slot);
+  size_t outSize = nn_instance->m_method->outSize(nn_instance->m_bufferSize);
+  if (!remote->isOpen()) {
+    std::fill_n(out, outSize, 0.f);
+    return;
+  }
+  for (auto& attr: nn_instance->m_attributes) {
+    float value;
+    if (attr.consume(value) && !remote->setAttribute(attr.getName(), value))
+      Print("NNUGen: can't set attribute %s\n", attr.getName());
+  }
+  ScopedTimer timer(nn_instance->m_stats->inference);
+  if (!remote->perform(nn_instance->inModel(slot), out)) {
+    std::fill_n(out, outSize, 0.f);
+    Print("NNUGen: %s\n", remote->error());
+  }
+}
+
+void model_perform(NN* nn_instance, int slot) {
+  if (nn_instance->m_remote) {
+    model_perform_remote(nn_instance, slot);
+    return;
+  }
+  auto& stats = *nn_instance->m_stats;
+  if (!nn_instance->m_attributes.empty()) {
+    ScopedTimer timer(stats.attributes);
+    model_perform_attributes(nn_instance, *nn_instance->m_model);
+  }
+  ScopedTimer timer(stats.inference);
+  nn_instance->m_model->perform(nn_instance->m_blocks[slot]);
+}
+
+
+// JOBS
+
+// batched instances leave their scheduler, which frees them when it's done
+// with their buffers
+static void model_finish(NN* nn_instance) {
+  if (auto batch = nn_instance->m_batch.load())
+    batch->leave(nn_instance->m_batchSlot);
+  else
+    model_perform_cleanup(nn_instance);
+}
+
+// drop a reference to nn_instance: the last one frees it
+static void model_release(NN* nn_instance) {
+  if (nn_instance->m_refs.fetch_sub(1) == 1)
+    model_finish(nn_instance);
+}
+
+// take a reference for the job, released when the job is done
+static bool model_submit(NN* nn_instance, void (*job)(void*)) {
+  nn_instance->m_refs++;
+  if (gWorkers.submit({job, nn_instance})) return true;
+  nn_instance->m_refs--;
+  return false;
+}
+
+// costs are measured once per method, on an instance of their own
+static void model_measure_costs(NN* nn_instance) {
+  auto method = nn_instance->m_method;
+  auto desc = nn_instance->m_modelDesc;
+  if (!method->costs->beginMeasure()) return;
+  auto shared = desc->getBackend();
+  Backend probe;
+  if (!shared || probe.load(*shared)) {
+    method->costs->endMeasure();
+    return;
+  }
+  probe.set_num_threads(desc->getThreads(method));
+  measureCosts(*method->costs, probe, *method, desc->getHigherRatio(),
+               nn_instance->mWorld->mBufLength, nn_instance->mWorld->mSampleRate);
+  if (nn_instance->m_debug >= Debug::all)
+    Print("NNUGen: measured costs of %s\n", method->name.c_str());
+}
+
+// joining may start a scheduler and its thread: not on the audio thread.
+// If the batch is full, the instance runs on its own
+static void model_join_job(void* data) {
+  auto nn_instance = static_cast<NN*>(data);
+  int slot;
+  if (auto batch = BatchScheduler::join(nn_instance, nn_instance->m_warmup, slot)) {
+    nn_instance->m_batchSlot = slot;
+    nn_instance->m_batch.store(batch, std::memory_order_release);
+  } else {
+    nn_instance->m_model = gBackendPool.checkout(nn_instance->m_modelDesc,
+                                                 nn_instance->m_method,
+                                                 nn_instance->m_bufferSize);
+    model_perform_load(nn_instance, nn_instance->m_warmup);
+  }
+  model_release(nn_instance);
+}
+
+// with the thread count of the workers the costs are planned for
+static void model_measure_job(void* data) {
+  auto nn_instance = static_cast<NN*>(data);
+  Backend::set_thread_num_threads(workerNumThreads());
+  model_measure_costs(nn_instance);
+  Backend::set_thread_num_threads(0);
+  model_release(nn_instance);
+}
+
+// measuring keeps a thread busy for a while: on the loader, off the
+// threads starting other instances
+static void model_load_job(void* data) {
+  auto nn_instance = static_cast<NN*>(data);
+  model_perform_load(nn_instance, nn_instance->m_warmup);
+  if (nn_instance->m_measureCosts) {
+    nn_instance->m_refs++;
+    gLoader.submit(-1, {model_measure_job, nn_instance});
+  }
+  model_release(nn_instance);
+}
+
+// one job at a time per instance processes pending slots in order,
+// since model state depends on the previous block
+static void model_perform_job(void* data) {
+  auto nn_instance = static_cast<NN*>(data);
+  int slot;
+  do {
+    while (nn_instance->m_pending.pop(slot)) {
+      nn_instance->m_stats->queueWait.record(
+        StatsClock::now() - nn_instance->m_submitTimes[slot]);
+      model_perform(nn_instance, slot);
+      nn_instance->m_done.push(slot);
+    }
+    nn_instance->m_performing = false;
+    // a slot queued after the last pop found this job still running,
+    // and didn't submit another one: take it, unless a new job did
+  } while (!nn_instance->m_pending.empty() && !nn_instance->m_performing.exchange(true));
+  model_release(nn_instance);
+}
+
+// start a perform job for pending slots, unless one is running. Returns
+// false if it couldn't be submitted: the caller retries on later blocks
+static bool model_start_perform(NN* nn_instance) {
+  if (nn_instance->m_pending.empty() || nn_instance->m_performing.exchange(true))
+    return true;
+  if (model_submit(nn_instance, model_perform_job)) return true;
+  nn_instance->m_performing = false;
+  return false;
+}
+
+// queue a slot for processing, starting a perform job if none is running
+static void model_submit_slot(NN* nn_instance, int slot) {
+  nn_instance->m_submitTimes[slot] = StatsClock::now();
+  nn_instance->m_pending.push(slot);
+  model_start_perform(nn_instance);
+}
+
+static void model_cleanup_job(void* data) {
+  model_finish(static_cast<NN*>(data));
+}
+
+// audio thread: free instances released by other threads, and queue jobs
+// that couldn't be queued before
+static void serviceInstances() {
+  if (gReleased.load(std::memory_order_relaxed)) {
+    for (NN* nn = gReleased.exchange(nullptr); nn;) {
+      NN* next = nn->m_nextInList;
+      model_free(nn);
+      nn = next;
+    }
+  }
+  if (gOrphans.load(std::memory_order_relaxed)) {
+    for (NN* nn = gOrphans.exchange(nullptr); nn;) {
+      NN* next = nn->m_nextInList;
+      if (!gBackground.submit({model_cleanup_job, nn})) pushInstance(gOrphans, nn);
+      nn = next;
     }
   }
-  model_perform_cleanup(nn_instance);
-  /* Print("thread exit\n"); */
+  if (gPendingStarts.load(std::memory_order_relaxed)) {
+    for (NN* nn = gPendingStarts.exchange(nullptr); nn;) {
+      NN* next = nn->m_nextInList;
+      if (!gBackground.submit({nn->m_startJob, nn})) pushInstance(gPendingStarts, nn);
+      nn = next;
+    }
+  }
+}
+
+void NNUGen::exchangeBuffers(int slot) {
+  float* inModel = m_sharedData->inModel(slot);
+  float* outModel = m_sharedData->outModel(slot);
+  // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND MODEL BUFFER
+  m_inBuffer->get(inModel, m_inFrames, m_inFrames);
+  // TRANSFER MEMORY BETWEEN OUTPUT CIRCULAR BUFFER AND MODEL BUFFER
+  m_outBuffer->put(outModel, m_outFrames, m_outFrames);
 }
 
 void NNUGen::next(int nSamples) {
 
-  if (!m_sharedData->m_loaded) {
+  serviceInstances();
+  if (m_auto) updatePlan();
+
+  auto batch = m_sharedData->m_batch.load(std::memory_order_acquire);
+  bool loaded = batch ? batch->isLoaded() : m_sharedData->m_loaded.load();
+  if (!loaded) {
     ClearUnitOutputs(this, nSamples);
     return;
   };
@@ -158,38 +448,48 @@ void NNUGen::next(int nSamples) {
   // update attr setters
   for (auto& a: m_sharedData->m_attributes) a.update(this, nSamples);
 
-  // copy inputs to circular buffer
-  for (int c(0); c < m_inDim; ++c) {
-    m_inBuffer[c].put(in(UGenInputs::inputs + c), bufferSize());
-  }
+  // copy inputs to circular buffer: control-rate inputs hold their value
+  m_inBuffer->put(mInBuf + UGenInputs::inputs, bufferSize(), [this](int c) {
+    return isAudioRateIn(UGenInputs::inputs + c) ? 1 : 0;
+  });
 
-  if (m_inBuffer[0].full()) {
+  if (m_inBuffer->full()) {
+    auto& stats = *m_sharedData->m_stats;
+    bool handedOver = true, late = false;
 
     if (!m_useThread) {
-
-      for (int c(0); c < m_inDim; ++c)
-        m_inBuffer[c].get(&m_inModel[c * m_bufferSize], m_bufferSize);
-
-      model_perform(m_sharedData);
-
-      for (int c(0); c < m_outDim; ++c)
-        m_outBuffer[c].put(&m_outModel[c * m_bufferSize], m_bufferSize);
-    } else if (m_sharedData->m_result_available_lock.try_acquire()) {
-      /* Print("sending\n"); m_sharedData->timer.reset(); */
-      // TRANSFER MEMORY BETWEEN INPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_inDim; ++c)
-        m_inBuffer[c].get(&m_inModel[c * m_bufferSize], m_bufferSize);
-      // TRANSFER MEMORY BETWEEN OUTPUT CIRCULAR BUFFER AND MODEL BUFFER
-      for (int c(0); c < m_outDim; ++c)
-        m_outBuffer[c].put(&m_outModel[c * m_bufferSize], m_bufferSize);
-      // SIGNAL PERFORM THREAD THAT DATA IS AVAILABLE
-      m_sharedData->m_data_available_lock.release();
+      auto start = StatsClock::now();
+      m_inBuffer->get(m_inModel, m_inFrames, m_inFrames);
+      model_perform(m_sharedData, 0);
+      m_outBuffer->put(m_outModel, m_outFrames, m_outFrames);
+      late = m_auto && StatsClock::now() - start > m_inlineBudget;
+    } else if (batch) {
+      int slot = m_sharedData->m_batchSlot;
+      if ((handedOver = batch->ready(slot))) {
+        exchangeBuffers(0);
+        m_sharedData->m_submitTimes[0] = StatsClock::now();
+        batch->submit(slot);
+      }
+    } else {
+      // slots left pending by a job that couldn't be submitted would never
+      // come back: submit it again
+      model_start_perform(m_sharedData);
+      // exchange with the oldest slot in flight, if its result is ready:
+      // otherwise skip this block
+      int slot;
+      if ((handedOver = m_sharedData->m_done.pop(slot))) {
+        exchangeBuffers(slot);
+        model_submit_slot(m_sharedData, slot);
+      }
     }
+
+    if (handedOver) stats.blocks.fetch_add(1, std::memory_order_relaxed);
+    else stats.missedHandoffs.fetch_add(1, std::memory_order_relaxed);
+    m_missHistory = (m_missHistory << 1) | (!handedOver || late);
   }
 
   // copy circular buf to out
-  for (int c(0); c < m_sharedData->m_outDim; ++c)
-    m_outBuffer[c].get(out(c), bufferSize());
+  m_outBuffer->get(mOutBuf, bufferSize());
 }
 
 NN::NN(
@@ -197,26 +497,38 @@ NN::NN(
   const NNModelDesc* modelDesc, const NNModelMethod* modelMethod,
   float* inModel, float* outModel,  
   RingBuf* inRing, RingBuf* outRing,
-  int bufferSize, int debug): 
+  int bufferSize, int depth, int debug): 
   mWorld(world),
   m_inModel(inModel), m_outModel(outModel),
   m_inBuffer(inRing), m_outBuffer(outRing),
   m_method(modelMethod), m_modelDesc(modelDesc), 
-  m_bufferSize(bufferSize), m_debug(debug),
-  m_compute_thread(nullptr),
-  m_data_available_lock(0), m_result_available_lock(1),
-  m_should_stop_perform_thread(false), m_loaded(false)
+  m_bufferSize(bufferSize), m_debug(debug), m_warmup(0),
+  m_depth(depth), m_performing(false),
+  m_refs(1), m_useWorkers(false), m_measureCosts(false),
+  m_loaded(false),
+  m_model(nullptr), m_remote(nullptr), m_batch(nullptr), m_batchSlot(-1),
+  m_stats(nullptr), m_nextInList(nullptr), m_startJob(nullptr)
 {
+  // keeps model and method alive while this instance uses them
+  m_modelDesc->retain();
   m_inDim = m_method->inDim;
   m_outDim = m_method->outDim;
+  // all slots start done, with silent results: the first m_depth blocks
+  // output silence, and each block then has m_depth buffers to complete
+  for (int slot = 0; slot < m_depth; ++slot) m_done.push(slot);
 }
 
 
 NNUGen::NNUGen(): 
-  m_inBuffer(nullptr), m_outBuffer(nullptr)
+  m_sharedData(nullptr), m_inBuffer(nullptr), m_outBuffer(nullptr),
+  m_auto(false), m_planned(false), m_nextUseThread(false),
+  m_nextData(nullptr), m_missHistory(0)
 {
+  serviceInstances();
   auto modelIdx = static_cast<unsigned short>(in0(UGenInputs::modelIdx));
-  const NNModelDesc* modelDesc = gModels.get(modelIdx);
+  // held until instances have retained it
+  NNModelRef model = gModels.get(modelIdx);
+  const NNModelDesc* modelDesc = model.get();
   const NNModelMethod* modelMethod = nullptr;
   if (modelDesc)
     modelMethod = getModelMethod(modelDesc, in0(UGenInputs::methodIdx));
@@ -232,7 +544,37 @@ NNUGen::NNUGen():
   // don't use external thread on NRT
   m_useThread = mWorld->mRealTime;
   int modelHigherRatio = modelDesc->getHigherRatio();
-  if (m_bufferSize < 0) {
+  // remote models are batched by the daemon, with other servers' UGens,
+  // and have no local costs to plan from
+  bool remote = modelDesc->isRemote();
+  bool batch = in0(UGenInputs::batch) > 0 && !remote;
+  // the batch shares one model instance: attributes would change it for
+  // every member
+  if (batch && maxAttributes() > 0) {
+    batch = false;
+    Print("NNUGen: UGens with attributes can't be batched, using their own instance\n");
+  }
+  // rows of a batch aren't tied to voices: streaming state would go from
+  // one voice to another
+  if (batch && !modelMethod->stateless) {
+    batch = false;
+    Print("NNUGen: %s is stateful and can't be batched, using its own instance\n",
+          modelMethod->name.c_str());
+  }
+  // auto: planned from measured costs if there are any, or measured by this
+  // instance and planned again when they are ready
+  m_auto = m_bufferSize == autoBufferSize && m_useThread && !batch && !remote;
+  if (m_auto) {
+    auto& costs = *modelMethod->costs;
+    m_planned = costs.measured();
+    Plan plan = makePlan(costs, modelHigherRatio, fullBufferSize(),
+                         mWorld->mSampleRate, 0, true);
+    m_bufferSize = plan.bufferSize;
+    m_useThread = plan.useThread;
+    m_inlineBudget = std::chrono::duration_cast<StatsClock::duration>(
+      std::chrono::duration<double, std::milli>(
+        inlineBudgetMs(fullBufferSize(), mWorld->mSampleRate)));
+  } else if (m_bufferSize < 0) {
     m_bufferSize = modelHigherRatio;
   } else if (m_bufferSize == 0) {
     // NO THREAD MODE
@@ -248,122 +590,273 @@ NNUGen::NNUGen():
       Print("NNUGen: rounding buffer size %d.\n", m_bufferSize);
     }
   }
+  // waiting for the daemon would block the audio thread
+  if (remote && mWorld->mRealTime && !m_useThread) {
+    m_useThread = true;
+    Print("NNUGen: remote models can't run inline, using workers\n");
+  }
+
+  // rings and model buffers hold one value per model frame
+  m_inRatio = modelMethod->inRatio;
+  m_outRatio = modelMethod->outRatio;
+  m_inFrames = m_bufferSize / m_inRatio;
+  m_outFrames = m_bufferSize / m_outRatio;
 
-  if (bufferSize() > m_bufferSize) {
-    Print("NNUGen: blockSize(%d) larger than model bufferSize(%d), disabling\n", bufferSize(), m_bufferSize);
+  if (fullBufferSize() > m_bufferSize) {
+    Print("NNUGen: blockSize(%d) larger than model bufferSize(%d), disabling\n", fullBufferSize(), m_bufferSize);
     set_calc_function<NNUGen, &NNUGen::clearOutputs>();
     return;
   }
 
-  Unit* unit = this;
-  if (!allocBuffers()) {
-    freeBuffers();
-    ClearUnitOnMemFailed;
+  // at control rate, one sample is a whole block: frames are decimated and
+  // held in control periods, so they must span whole blocks
+  m_period = calcRate() == calc_BufRate ? fullBufferSize() : 1;
+  if (m_inRatio % m_period != 0 || m_outRatio % m_period != 0) {
+    Print("NNUGen: kr needs method ratios (in %d, out %d) multiple of blockSize(%d), disabling\n",
+          m_inRatio, m_outRatio, m_period);
+    set_calc_function<NNUGen, &NNUGen::clearOutputs>();
+    return;
+  }
+  if (m_inRatio < fullBufferSize()) {
+    for (int i = 0; i < m_inDim; ++i) {
+      if (isAudioRateIn(UGenInputs::inputs + i)) continue;
+      Print("NNUGen: inRatio(%d) smaller than blockSize(%d), control-rate inputs are held over several frames\n",
+            m_inRatio, fullBufferSize());
+      break;
+    }
   }
 
+  // only blocks processed by workers can be pipelined
+  m_depth = (m_useThread && !batch) ? pipelineDepth() : 1;
   m_debug = static_cast<int>(in0(UGenInputs::debug));
 
-  void* data = RTAlloc(mWorld, sizeof(NN));
-  if (!data) {
-    freeBuffers();
-    ClearUnitOnMemFailed;
+  NN* nn = newInstance(modelDesc, modelMethod, m_bufferSize, m_depth);
+  Unit* unit = this;
+  if (nn == nullptr) ClearUnitOnMemFailed;
+  adopt(nn);
+  nn->m_measureCosts = m_auto && !m_planned;
+
+  if (m_debug >= Debug::all) {
+    // input buffer fill, plus one buffer per block in flight
+    int latency = (m_useThread ? m_depth + 1 : 1) * m_bufferSize - fullBufferSize();
+    Print("NNUGen: latency %d samples\n", latency);
   }
-  m_sharedData = new(data) NN(mWorld, modelDesc, modelMethod, 
-                        m_inModel, m_outModel, m_inBuffer, m_outBuffer,
-                        m_bufferSize, m_debug);
-
-  int warmup = static_cast<int>(in0(UGenInputs::warmup));
-  if (m_useThread)
-    m_sharedData->m_compute_thread = new std::thread(model_perform_loop, m_sharedData, warmup);
-  else
-    model_perform_load(m_sharedData, warmup);
 
-  setupAttributes();
+  // on real-time servers, models load on background threads even when
+  // performing inline
+  startInstance(nn, m_useThread && batch, !mWorld->mRealTime);
 
   mCalcFunc = make_calc_function<NNUGen, &NNUGen::next>();
   /* Print("NN: Ctor done\n"); */
 }
 
-NNUGen::~NNUGen() {
-  /* Print("NN: Dtor\n"); */
-  if (m_sharedData->m_compute_thread) {
-    // don't wait for join, it would stall the dsp chain
-    // thread frees resources when stopped
-    m_sharedData->m_should_stop_perform_thread = true;
-    /* m_compute_thread->join(); */
+// don't wait for jobs, it would stall the dsp chain
+static void releaseInstance(NN* nn) {
+  if (nn->m_useWorkers) {
+    // last job frees resources, or a cleanup job if none is queued
+    if (nn->m_refs.fetch_sub(1) == 1 &&
+        !gBackground.submit({model_cleanup_job, nn}))
+      pushInstance(gOrphans, nn);
   } else {
+    // NRT: no audio thread to protect
     /* Print("freeing manually\n"); */
-    m_sharedData->~NN(); // this frees resources
-    RTFree(mWorld, m_sharedData);
+    nn->releaseModel();
+    model_free(nn);
+  }
+}
+
+NNUGen::~NNUGen() {
+  /* Print("NN: Dtor\n"); */
+  // disabled in Ctor, before allocating anything
+  if (m_sharedData == nullptr) return;
+  serviceInstances();
+  releaseInstance(m_sharedData);
+  if (m_nextData) releaseInstance(m_nextData);
+}
+
+int NNUGen::pipelineDepth() {
+  int depth = static_cast<int>(in0(UGenInputs::pipeline));
+  if (depth < 1 || depth > maxPipelineDepth) {
+    depth = std::clamp(depth, 1, maxPipelineDepth);
+    Print("NNUGen: pipeline depth out of range, switching to %d.\n", depth);
   }
+  return depth;
 }
 
 // BUFFERS
 
-RingBuf* allocRingBuffer(World* world, size_t bufSize, size_t numChannels) {
-  RingBuf* ctrs = rtAlloc<RingBuf>(world, numChannels);
-  float* data = rtAlloc<float>(world, numChannels * bufSize);
-  if (ctrs == nullptr || data == nullptr) {
-    RTFree(world, ctrs); return nullptr;
+RingBuf* allocRingBuffer(World* world, int numFrames, int numChannels, int ratio) {
+  RingBuf* ring = rtAlloc<RingBuf>(world);
+  size_t dataSize = numChannels * RingBuf::capacity(numFrames);
+  float* data = rtAlloc<float>(world, dataSize);
+  if (ring == nullptr || data == nullptr) {
+    RTFree(world, ring); RTFree(world, data); return nullptr;
   };
-  memset(data, 0, sizeof(float) * numChannels * bufSize);
-  for (int c(0); c < numChannels; ++c) {
-    auto buf = data + (bufSize * c);
-    new(ctrs + c) RingBuf(buf, bufSize);
-  };
-  /* Print("ctrs: %p\ndata: %p\n", ctrs, data); */
-  return ctrs;
+  memset(data, 0, sizeof(float) * dataSize);
+  /* Print("ring: %p\ndata: %p\n", ring, data); */
+  return new(ring) RingBuf(data, numChannels, numFrames, ratio);
 }
 
 void freeRingBuffer(World* world, RingBuf* buf) {
   if (buf == nullptr) return;
-  RTFree(world, buf[0].getBuffer()); // data
+  RTFree(world, buf->getBuffer()); // data
   RTFree(world, buf);
 }
 
-bool NNUGen::allocBuffers() {
-  m_inBuffer = allocRingBuffer(mWorld, m_bufferSize, m_inDim);
-  if (m_inBuffer == nullptr) return false;
-  m_outBuffer = allocRingBuffer(mWorld, m_bufferSize, m_outDim);
-  if (m_outBuffer == nullptr) return false;
-  m_inModel = rtAlloc<float>(mWorld, m_bufferSize * m_inDim);
-  if (m_inModel == nullptr) return false;
-  m_outModel = rtAlloc<float>(mWorld, m_bufferSize * m_outDim);
-  if (m_outModel == nullptr) return false;
-  memset(m_inModel, 0, sizeof(float) * m_bufferSize * m_inDim);
-  memset(m_outModel, 0, sizeof(float) * m_bufferSize * m_outDim);
-  /* Print("m_inModel: %p\nm_outModel: %p\n", m_inModel, m_outModel); */
-  return true;
+// an instance with its own rings and model buffers, nullptr if out of memory
+NN* NNUGen::newInstance(const NNModelDesc* modelDesc, const NNModelMethod* modelMethod,
+                        int bufferSize, int depth) {
+  int inFrames = bufferSize / m_inRatio;
+  int outFrames = bufferSize / m_outRatio;
+  RingBuf* inRing = allocRingBuffer(mWorld, inFrames, m_inDim, m_inRatio / m_period);
+  RingBuf* outRing = allocRingBuffer(mWorld, outFrames, m_outDim, m_outRatio / m_period);
+  // one slot of model buffers per pipelined block
+  size_t inSize = depth * inFrames * m_inDim;
+  size_t outSize = depth * outFrames * m_outDim;
+  float* inModel = rtAlloc<float>(mWorld, inSize);
+  float* outModel = rtAlloc<float>(mWorld, outSize);
+  int numAttributes = maxAttributes();
+  NNSetAttr* attributes = numAttributes ? rtAlloc<NNSetAttr>(mWorld, numAttributes) : nullptr;
+  void* data = RTAlloc(mWorld, sizeof(NN));
+  if (!inRing || !outRing || !inModel || !outModel || !data ||
+      (numAttributes && !attributes)) {
+    freeRingBuffer(mWorld, inRing);
+    freeRingBuffer(mWorld, outRing);
+    RTFree(mWorld, inModel);
+    RTFree(mWorld, outModel);
+    RTFree(mWorld, attributes);
+    RTFree(mWorld, data);
+    return nullptr;
+  }
+  memset(inModel, 0, sizeof(float) * inSize);
+  memset(outModel, 0, sizeof(float) * outSize);
+  /* Print("m_inModel: %p\nm_outModel: %p\n", inModel, outModel); */
+
+  NN* nn = new(data) NN(mWorld, modelDesc, modelMethod,
+                        inModel, outModel, inRing, outRing,
+                        bufferSize, depth, m_debug);
+  // before starting the perform thread, which reads attributes
+  setupAttributes(nn, attributes);
+  nn->m_stats = gStats.claim(mParent->mNode.mID,
+                             static_cast<int>(in0(UGenInputs::modelIdx)),
+                             static_cast<int>(in0(UGenInputs::methodIdx)),
+                             bufferSize);
+  return nn;
 }
 
-void NNUGen::freeBuffers() {
-  /* Print("NN: freeing buffers\n"); */
-  freeRingBuffer(mWorld, m_inBuffer);
-  freeRingBuffer(mWorld, m_outBuffer);
-  RTFree(mWorld, m_inModel);
-  RTFree(mWorld, m_outModel);
-  /* RTFree(mWorld, m_model); */
+// process with this instance from now on
+void NNUGen::adopt(NN* nn) {
+  m_sharedData = nn;
+  m_bufferSize = nn->m_bufferSize;
+  m_depth = nn->m_depth;
+  m_inFrames = m_bufferSize / m_inRatio;
+  m_outFrames = m_bufferSize / m_outRatio;
+  m_inBuffer = nn->m_inBuffer;
+  m_outBuffer = nn->m_outBuffer;
+  m_inModel = nn->m_inModel;
+  m_outModel = nn->m_outModel;
+}
+
+// join a batch, or load the model inline or on a background thread. Jobs
+// that can't be queued now are retried on later blocks
+void NNUGen::startInstance(NN* nn, bool batch, bool loadInline) {
+  nn->m_warmup = static_cast<int>(in0(UGenInputs::warmup));
+  nn->m_useWorkers = !loadInline;
+  if (batch) {
+    // model is loaded and run by the batch scheduler, joined on a
+    // background thread
+    alignToBatch();
+    nn->m_startJob = model_join_job;
+  } else {
+    nn->m_model = gBackendPool.checkout(nn->m_modelDesc, nn->m_method, nn->m_bufferSize);
+    if (loadInline) {
+      model_perform_load(nn, nn->m_warmup);
+      return;
+    }
+    nn->m_startJob = model_load_job;
+  }
+  // the job's reference is kept while it waits to be queued
+  nn->m_refs++;
+  if (!gBackground.submit({nn->m_startJob, nn})) pushInstance(gPendingStarts, nn);
+}
+
+// AUTO BUFFER SIZE
+
+// plan once costs are measured, and again after sustained deadline misses:
+// the new instance is loaded on a background thread, while the current one
+// keeps processing, and replaces it when ready
+void NNUGen::updatePlan() {
+  if (m_nextData) {
+    if (!m_nextData->m_loaded.load()) return;
+    releaseInstance(m_sharedData);
+    adopt(m_nextData);
+    m_useThread = m_nextUseThread;
+    m_nextData = nullptr;
+    m_missHistory = 0;
+    if (m_debug >= Debug::all)
+      Print("NNUGen: switched to bufferSize %d, %s\n", m_bufferSize,
+            m_useThread ? "on workers" : "inline");
+    return;
+  }
+
+  auto& costs = *m_sharedData->m_method->costs;
+  if (!costs.measured()) return;
+  bool missing = std::popcount(m_missHistory) >= maxRecentMisses;
+  if (m_planned && !missing) return;
+  m_planned = true;
+  m_missHistory = 0;
+
+  // after misses, inline blocks move to workers, and threaded ones grow
+  int minSize = !missing ? 0 : m_useThread ? m_bufferSize * 2 : m_bufferSize;
+  Plan plan = makePlan(costs, m_sharedData->m_modelDesc->getHigherRatio(),
+                       fullBufferSize(), mWorld->mSampleRate, minSize, !missing);
+  if (plan.bufferSize == m_bufferSize && plan.useThread == m_useThread) return;
+
+  NN* next = newInstance(m_sharedData->m_modelDesc, m_sharedData->m_method,
+                         plan.bufferSize, plan.useThread ? pipelineDepth() : 1);
+  if (next == nullptr) return;
+  startInstance(next, false, false);
+  m_nextData = next;
+  m_nextUseThread = plan.useThread;
+}
+
+// BATCHING
+
+// prefill input buffers so that they fill up when the global sample count
+// is a multiple of m_bufferSize: all members of a batch then submit their
+// blocks during the same server cycle
+void NNUGen::alignToBatch() {
+  int phase = (mWorld->mBufCounter * fullBufferSize()) % m_bufferSize;
+  if (phase == 0) return;
+  m_inBuffer->putSilence(phase / m_period);
+}
+
+void NN::releaseModel() {
+  if (m_model)
+    gBackendPool.checkin(m_modelDesc, m_method, m_bufferSize, m_model);
+  m_model = nullptr;
+  delete m_remote;
+  m_remote = nullptr;
+  // bound methods hold model references
+  for (auto& block: m_blocks) block = PerformBlock();
+  for (auto& attr: m_attributes) attr.setter = AttributeSetter();
 }
 
 NN::~NN() {
+  if (m_stats) gStats.release(m_stats);
+  for (auto& attr: m_attributes) attr.~NNSetAttr();
+  RTFree(mWorld, m_attributes.data());
   freeRingBuffer(mWorld, m_inBuffer);
   freeRingBuffer(mWorld, m_outBuffer);
   RTFree(mWorld, m_inModel);
   RTFree(mWorld, m_outModel);
-  if (m_compute_thread) { free(m_compute_thread); }
+  // last: the model may be freed right away
+  m_modelDesc->release();
 }
 
 void NN::warmupModel(int n_passes=1) {
-  /* Timer timer; */
-  std::vector<float *> in_model, out_model;
-  for (int c(0); c < m_inDim; ++c)
-    in_model.push_back(&m_inModel[m_bufferSize * c]);
-  for (int c(0); c < m_outDim; ++c)
-    out_model.push_back(&m_outModel[m_bufferSize * c]);
-
   for(int i=0; i < n_passes; ++i)
-    m_model.perform(in_model, out_model, m_bufferSize, m_method->name, 1);
-  /* timer.print("warmup:"); */
+    m_model->perform(m_blocks[0]);
 }
 
 } // namespace NN
@@ -376,61 +869,3 @@ PluginLoad(NNUGens) {
   registerUnit<NN::NNUGen>(ft, "NNUGen", false);
   NN::Cmd::definePlugInCmds();
 }
-
-// custom perform method:
-// - avoid creating vectors
-// - no lock
-// - simplified tensor_in reshaping
-/* auto const CPU = torch::kCPU; */
-/* void SCBackend::perform( */
-/*   float* in_buffer, float* out_buffer, int n_vec, */ 
-/*   const NNModelMethod* method, int n_batches) const { */
-
-/*   c10::InferenceMode guard; */
-/*   int in_dim = method->inDim; */
-/*   int in_ratio = method->inRatio; */
-/*   int out_dim = method->outDim; */
-/*   int out_ratio = method->outRatio; */
-/*   auto script_method = m_model.get_method(method->name); */
-
-/*   /1* if (!m_loaded) return; *1/ */
-
-/*   // COPY BUFFER INTO A TENSOR */
-/*   /1* auto tensor_in = torch::from_blob(in_buffer, {1, in_dim, n_vec}); *1/ */
-/*   /1* tensor_in = tensor_in.reshape({in_dim, n_batches, -1, in_ratio}); *1/ */
-/*   auto tensor_in = torch::from_blob(in_buffer, {n_batches, in_dim, n_vec/in_ratio, in_ratio}); */
-/*   tensor_in = tensor_in.select(-1, -1); */
-/*   /1* tensor_in = tensor_in.permute({1, 0, 2}); *1/ */
-
-/*   // SEND TENSOR TO DEVICE */
-/*   /1* std::unique_lock<std::mutex> model_lock(m_model_mutex); *1/ */
-/*   tensor_in = tensor_in.to(m_device); */
-/*   std::vector<torch::jit::IValue> inputs = {tensor_in}; */
-
-/*   // PROCESS TENSOR */
-/*   at::Tensor tensor_out; */
-/*   try { */
-/*     tensor_out = script_method(inputs).toTensor(); */
-/*     tensor_out = tensor_out.repeat_interleave(out_ratio).reshape( */
-/*         {n_batches, out_dim, -1}); */
-/*   } catch (const std::exception &e) { */
-/*     std::cerr << e.what() << '\n'; */
-/*     return; */
-/*   } */
-/*   /1* model_lock.unlock(); *1/ */
-
-/*   int out_batches(tensor_out.size(0)), out_channels(tensor_out.size(1)), */
-/*       out_n_vec(tensor_out.size(2)); */
-
-/*   if (out_n_vec != n_vec) { */
-/*     std::cout << "model output size is not consistent, expected " << n_vec */
-/*               << " samples, got " << out_n_vec << "!\n"; */
-/*     return; */
-/*   } */
-
-/*   tensor_out = tensor_out.to(CPU); */
-/*   tensor_out = tensor_out.reshape({out_batches * out_channels, -1}); */
-/*   auto out_ptr = tensor_out.contiguous().data_ptr<float>(); */
-
-/*   memcpy(out_buffer, out_ptr, n_vec * sizeof(float)); */
-/* } */
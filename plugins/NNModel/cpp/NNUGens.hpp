@@ -4,39 +4,36 @@
 #include "NNModel.hpp"
 #include "backend/backend.h"
 #include "SC_PlugIn.hpp"
-#include "rt_circular_buffer.h"
+#include "NNRemote.hpp"
+#include "NNRingBuffer.hpp"
+#include "NNSpscQueue.hpp"
+#include "NNStats.hpp"
+#include <array>
+#include <atomic>
 #include <chrono>
-#include <semaphore>
+#include <span>
 #include <string>
-#include <thread>
 
 namespace NN {
 
-using RingBuf = RingBufCtrl<float, float>;
+class BatchScheduler;
 
 enum Debug { none=0, attributes=1, all=2 };
 
-/* class Timer { */
-/*   std::chrono::high_resolution_clock::time_point start; */
-/* public: */ 
-/*   Timer() { reset(); } */
-
-/*   void reset() { */
-/*     start = std::chrono::high_resolution_clock::now(); */
-/*   } */
-/*   void print(const char* label) { */
-/*     auto now = std::chrono::high_resolution_clock::now(); */
-/*     std::cout << label */
-/*       << std::chrono::duration_cast<std::chrono::milliseconds>(now - start) */
-/*       << std::endl; */
-/*   } */
-/* }; */
+// most model blocks that can be in flight at once
+constexpr int maxPipelineDepth = 16;
+// bufferSize argument for a size planned from measured costs
+constexpr int autoBufferSize = -2;
+// deadline misses, out of the last 32 blocks, that trigger a new plan
+constexpr int maxRecentMisses = 4;
 
 class NNSetAttr {
 public:
   const NNModelAttribute* attr;
   // remember in0 indices
   int inputIdx;
+  // resolved by the perform thread on first set
+  AttributeSetter setter;
 
   NNSetAttr(const NNModelAttribute* attr, int inputIdx, float initVal);
 
@@ -44,32 +41,36 @@ public:
   void update(Unit* unit, int nSamples);
 
   const char* getName() const { return attr->name.c_str(); }
-  bool changed() const { return valUpdated; }
-  // called before model_perform
-  std::string getStrValue() {
-    valUpdated = false;
-    if (attr->type == NNAttributeType::typeBool)
-      return value > 0 ? "true" : "false";
-    else if (attr->type == NNAttributeType::typeInt)
-      return std::to_string(static_cast<int>(value));
-    return std::to_string(value);
+  // called before model_perform: get latest value, if it was updated
+  bool consume(float& newValue) {
+    if (!valUpdated.exchange(false, std::memory_order_acquire)) return false;
+    newValue = value.load(std::memory_order_relaxed);
+    return true;
   }
 
 private:
   float lastTrig = 0;
-  float value = 0;
-  bool valUpdated = false;
+  float lastValue = 0;
+  // latest value slot, handed over from audio thread
+  std::atomic<float> value;
+  std::atomic<bool> valUpdated;
 };
 
 class NN {
 public:
   NN(World* world, const NNModelDesc* modelDesc, const NNModelMethod* modelMethod,
      float* inModel, float* outModel,  RingBuf* m_inBuffer, RingBuf* m_outBuffer,
-     int bufferSize, int m_debug);
+     int bufferSize, int depth, int m_debug);
 
+  // frees real-time memory: audio thread only
   ~NN();
 
+  // release what lives on the system heap, with the model: off the audio thread
+  void releaseModel();
   void warmupModel(int n_passes);
+  // model buffers of a pipeline slot
+  float* inModel(int slot) const { return m_inModel + slot * m_method->inSize(m_bufferSize); }
+  float* outModel(int slot) const { return m_outModel + slot * m_method->outSize(m_bufferSize); }
 
   RingBuf* m_inBuffer;
   RingBuf* m_outBuffer;
@@ -78,17 +79,44 @@ public:
   const NNModelDesc* m_modelDesc;
   const NNModelMethod* m_method;
   World* mWorld;
-  std::thread* m_compute_thread;
-  std::binary_semaphore m_data_available_lock, m_result_available_lock;
   int m_inDim, m_outDim;
-  int m_bufferSize, m_debug;
-  std::vector<NNSetAttr> m_attributes;
-  Backend m_model;
-  bool m_should_stop_perform_thread;
-  bool m_loaded;
-  /* Timer timer; */
+  int m_bufferSize, m_debug, m_warmup;
+  // pipeline: up to m_depth blocks in flight on workers, each with its own
+  // slot of model buffers. Slots go to workers through m_pending,
+  // and come back with results through m_done
+  int m_depth;
+  SpscQueue<int, maxPipelineDepth> m_pending, m_done;
+  // set while a perform job is draining m_pending
+  std::atomic<bool> m_performing;
+  // held by the UGen and by each queued job: last one frees resources
+  std::atomic<int> m_refs;
+  bool m_useWorkers;
+  // measure method costs for auto buffer sizes after loading
+  bool m_measureCosts;
+  // on real-time memory, sized from the UGen's inputs
+  std::span<NNSetAttr> m_attributes;
+  // from BackendPool, or loaded by the perform thread
+  Backend* m_model;
+  // instead of m_model, for models running on nn_daemon
+  RemoteChannel* m_remote;
+  std::array<PerformBlock, maxPipelineDepth> m_blocks;
+  std::atomic<bool> m_loaded;
+  // set by a worker when processing is batched with other instances
+  std::atomic<BatchScheduler*> m_batch;
+  int m_batchSlot;
+  // always-on timings, reported by /nn_stats
+  NNStats* m_stats;
+  // when each slot was handed over, for queue wait
+  std::array<StatsClock::time_point, maxPipelineDepth> m_submitTimes;
+  // link in lists of instances handed back to the audio thread
+  NN* m_nextInList;
+  // load or join job, kept to retry it if it couldn't be queued
+  void (*m_startJob)(void*);
 };
 
+void model_perform_attributes(NN* nn_instance, Backend& backend);
+void model_perform_cleanup(NN* nn_instance);
+
 class NNUGen : public SCUnit {
 public:
 
@@ -96,15 +124,22 @@ public:
   ~NNUGen();
 
   void next(int nSamples);
-  void freeBuffers();
-  void setupAttributes();
 
   NN* m_sharedData;
 
 private:
-  enum UGenInputs { modelIdx=0, methodIdx, bufSize, warmup, debug, inputs };
+  enum UGenInputs { modelIdx=0, methodIdx, bufSize, warmup, debug, batch, pipeline, inputs };
   void clearOutputs(int nSamples);
-  bool allocBuffers();
+  NN* newInstance(const NNModelDesc* modelDesc, const NNModelMethod* modelMethod,
+                  int bufferSize, int depth);
+  int maxAttributes();
+  void setupAttributes(NN* nn, NNSetAttr* attributes);
+  void adopt(NN* nn);
+  void startInstance(NN* nn, bool batch, bool loadInline);
+  int pipelineDepth();
+  void updatePlan();
+  void alignToBatch();
+  void exchangeBuffers(int slot);
   void updateAttributes();
 
   RingBuf* m_inBuffer;
@@ -112,8 +147,19 @@ private:
   float* m_inModel;
   float* m_outModel;
   int m_inDim, m_outDim;
-  int m_bufferSize, m_debug;
+  // model frames per buffer, and samples per frame
+  int m_inFrames, m_outFrames, m_inRatio, m_outRatio;
+  // audio samples per sample of this unit: blockSize at control rate
+  int m_period;
+  int m_bufferSize, m_debug, m_depth;
   bool m_useThread;
+  // auto buffer size: planned once costs are measured, then after misses.
+  // The next instance replaces the current one once loaded
+  bool m_auto, m_planned, m_nextUseThread;
+  NN* m_nextData;
+  // one bit per block, set when it missed its deadline
+  uint32_t m_missHistory;
+  StatsClock::duration m_inlineBudget;
 };
 
 } // namespace NN
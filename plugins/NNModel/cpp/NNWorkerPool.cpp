@@ -0,0 +1,47 @@
+// NNWorkerPool.cpp
+#include "NNWorkerPool.hpp"
+#include <chrono>
+
+namespace NN {
+
+int WorkerPool::resolveNumWorkers(int numWorkers) {
+  if (numWorkers > 0) return numWorkers;
+  int cores = std::thread::hardware_concurrency();
+  return cores > 2 ? cores - 1 : 1;
+}
+
+WorkerPool::~WorkerPool() {
+  m_running = false;
+  m_work_available.release(m_threads.size());
+  for (auto& t: m_threads) t.join();
+}
+
+void WorkerPool::start() {
+  std::lock_guard<std::mutex> lock(m_startMutex);
+  if (m_started.load()) return;
+  int numWorkers = resolveNumWorkers(m_numWorkers);
+  for (int i = 0; i < numWorkers; ++i)
+    m_threads.emplace_back(loop, this);
+  m_started.store(true, std::memory_order_release);
+}
+
+bool WorkerPool::submit(Job job) {
+  if (!isStarted() || !m_queue.push(job)) return false;
+  m_work_available.release();
+  return true;
+}
+
+void WorkerPool::loop(WorkerPool* pool) {
+  if (pool->m_initThread) pool->m_initThread();
+  while (pool->m_running) {
+    if (!pool->m_work_available.try_acquire_for(std::chrono::milliseconds(200)))
+      continue;
+    // one job was queued for each release. It can only be missing while its
+    // producer is between claiming a cell and filling it
+    Job job;
+    while (pool->m_running && !pool->m_queue.pop(job)) std::this_thread::yield();
+    if (pool->m_running) job.fn(job.data);
+  }
+}
+
+} // namespace NN
@@ -0,0 +1,56 @@
+// NNWorkerPool.hpp
+
+#pragma once
+#include "NNMpmcQueue.hpp"
+#include <atomic>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+#include <vector>
+
+namespace NN {
+
+// a unit of work: no allocation needed to submit one
+struct Job {
+  void (*fn)(void*);
+  void* data;
+};
+
+// plugin-wide pool of worker threads, shared by all UGens.
+// Workers take jobs from a single lock-free queue. Threads are only started
+// by start, so that servers that never use them don't pay for them
+class WorkerPool {
+public:
+  static constexpr int queueSize = 1024;
+
+  // 0: one worker per core, leaving one for the audio thread.
+  // initThread is called by each worker when it starts
+  explicit WorkerPool(int numWorkers = 0, void (*initThread)() = nullptr):
+    m_numWorkers(numWorkers), m_initThread(initThread) {}
+  // number of workers that a pool of numWorkers starts
+  static int resolveNumWorkers(int numWorkers);
+  ~WorkerPool();
+
+  // start worker threads, if not started yet. Not RT-safe
+  void start();
+  bool isStarted() const { return m_started.load(std::memory_order_acquire); }
+
+  // RT-safe and lock-free. Returns false if the pool isn't started, or if
+  // its queue is full
+  bool submit(Job job);
+  int numWorkers() const { return m_threads.size(); }
+
+private:
+  static void loop(WorkerPool* pool);
+
+  MpmcQueue<Job, queueSize> m_queue;
+  std::vector<std::thread> m_threads;
+  std::counting_semaphore<> m_work_available{0};
+  int m_numWorkers;
+  void (*m_initThread)();
+  std::mutex m_startMutex;
+  std::atomic<bool> m_started{false};
+  std::atomic<bool> m_running{true};
+};
+
+} // namespace NN
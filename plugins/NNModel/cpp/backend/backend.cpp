@@ -1,17 +1,164 @@
 #include "backend.h"
 #include "parsing_utils.h"
+#include <ATen/Parallel.h>
 #include <algorithm>
 #include <iostream>
+#include <set>
 #include <stdlib.h>
 
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#endif
+
 #define CPU torch::kCPU
 #define CUDA torch::kCUDA
 #define MPS torch::kMPS
 
-Backend::Backend() : m_loaded(0), m_device(CPU), m_use_gpu(false) {
+std::atomic<int> Backend::s_default_num_threads(0);
+
+Backend::Backend()
+    : m_loaded(0), m_device(CPU), m_use_gpu(false), m_num_threads(0),
+      m_dtype(torch::kFloat) {
   at::init_num_threads();
 }
 
+// OpenMP keeps intra-op thread counts per calling thread, so that each
+// instance can use its own. Native builds have a single pool for the process
+bool Backend::has_per_instance_threads() { return AT_PARALLEL_OPENMP; }
+
+void Backend::set_num_threads(int num_threads) {
+  if (num_threads > 0 && !has_per_instance_threads()) {
+    static std::atomic<bool> warned(false);
+    if (!warned.exchange(true))
+      std::cerr << "warning: libtorch isn't built with OpenMP, per-model "
+                   "threads are ignored: set the default for all models\n";
+    return;
+  }
+  m_num_threads = num_threads;
+}
+
+void Backend::set_default_num_threads(int num_threads) {
+  s_default_num_threads = num_threads;
+  // the native pool can only be sized before its first parallel work:
+  // torch warns if it's too late
+  if (num_threads > 0 && !has_per_instance_threads())
+    at::set_num_threads(num_threads);
+}
+
+// can only be set once, before any inter-op parallel work has started
+bool Backend::set_num_interop_threads(int num_threads) {
+  try {
+    at::set_num_interop_threads(num_threads);
+    return true;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return false;
+  }
+}
+
+static thread_local int t_thread_num_threads = 0;
+
+void Backend::set_thread_num_threads(int num_threads) {
+  t_thread_num_threads = num_threads;
+}
+
+// intra-op thread count is per calling thread: set it only when
+// it differs from what this thread last used
+static void apply_num_threads(int num_threads) {
+  static thread_local int current_num_threads = 0;
+  if (num_threads > 0 && num_threads != current_num_threads) {
+    at::set_num_threads(num_threads);
+    current_num_threads = num_threads;
+  }
+}
+
+// native reduced precision arithmetic: without it, torch emulates it,
+// which is slower than fp32
+static bool cpu_supports(c10::ScalarType dtype) {
+#if defined(__x86_64__) || defined(_M_X64)
+  unsigned int regs[4];
+  auto cpuid = [&regs](unsigned int leaf, unsigned int subleaf) {
+#ifdef _MSC_VER
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    std::copy(r, r + 4, regs);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+  };
+  cpuid(0, 0);
+  if (regs[0] < 7)
+    return false;
+  // the OS must save AVX-512 registers too
+  cpuid(1, 0);
+  if (!(regs[2] & (1u << 27)))
+    return false;
+#ifdef _MSC_VER
+  unsigned long long xcr0 = _xgetbv(0);
+#else
+  unsigned int xcr0_lo, xcr0_hi;
+  __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+  unsigned long long xcr0 = xcr0_lo;
+#endif
+  if ((xcr0 & 0xe6) != 0xe6)
+    return false;
+  cpuid(7, 0);
+  bool avx512_fp16 = regs[3] & (1u << 23);
+  cpuid(7, 1);
+  bool avx512_bf16 = regs[0] & (1u << 5);
+  if (dtype == torch::kBFloat16)
+    return avx512_bf16;
+  if (dtype == torch::kFloat16)
+    return avx512_fp16;
+  return false;
+#elif defined(__aarch64__) && defined(__linux__)
+#if defined(HWCAP2_BF16) && defined(HWCAP_ASIMDHP)
+  if (dtype == torch::kBFloat16)
+    return getauxval(AT_HWCAP2) & HWCAP2_BF16;
+  if (dtype == torch::kFloat16)
+    return getauxval(AT_HWCAP) & HWCAP_ASIMDHP;
+#endif
+  return false;
+#elif defined(__APPLE__)
+  const char *feature = dtype == torch::kBFloat16 ? "hw.optional.arm.FEAT_BF16"
+                        : dtype == torch::kFloat16
+                            ? "hw.optional.arm.FEAT_FP16"
+                            : nullptr;
+  int supported = 0;
+  size_t size = sizeof(supported);
+  return feature && sysctlbyname(feature, &supported, &size, nullptr, 0) == 0 &&
+         supported;
+#else
+  return false;
+#endif
+}
+
+bool Backend::set_precision(c10::ScalarType dtype) {
+  if (dtype == m_dtype)
+    return true;
+  // GPUs are assumed to support reduced precision
+  if (dtype != torch::kFloat && m_device == CPU && !cpu_supports(dtype))
+    return false;
+  try {
+    std::unique_lock<std::mutex> model_lock(m_model_mutex);
+    m_model.to(dtype);
+    m_dtype = dtype;
+    return true;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return false;
+  }
+}
+
 void Backend::perform(std::vector<float *> in_buffer,
                       std::vector<float *> out_buffer, int n_vec,
                       std::string method, int n_batches) {
@@ -81,10 +228,95 @@ void Backend::perform(std::vector<float *> in_buffer,
   }
 }
 
+bool Backend::bind(PerformBlock &block, const std::string &method,
+                   float *in_buffer, float *out_buffer, int n_vec,
+                   int n_batches, int in_dim, int in_ratio, int out_dim,
+                   int out_ratio) {
+  if (!m_loaded)
+    return false;
+  try {
+    std::unique_lock<std::mutex> model_lock(m_model_mutex);
+    block.method = m_model.get_method(method);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return false;
+  }
+  // no copy: the model reads straight from the block
+  auto in_view =
+      torch::from_blob(in_buffer, {n_batches, in_dim, n_vec / in_ratio});
+  if (m_dtype == torch::kFloat) {
+    block.in_view = at::Tensor();
+    block.inputs = {in_view};
+  } else {
+    // converted on each perform, in a preallocated tensor
+    block.in_view = in_view;
+    block.inputs = {torch::empty({n_batches, in_dim, n_vec / in_ratio},
+                                 torch::TensorOptions().dtype(m_dtype))};
+  }
+  // outputs are converted and copied there in one pass
+  block.out_view =
+      torch::from_blob(out_buffer, {n_batches, out_dim, n_vec / out_ratio});
+  block.n_batches = n_batches;
+  block.out_dim = out_dim;
+  block.out_frames = n_vec / out_ratio;
+  return true;
+}
+
+// the resolved method keeps its module alive: no lock needed
+void Backend::perform(PerformBlock &block) {
+  c10::InferenceMode guard;
+
+  if (!block.is_bound())
+    return;
+
+  if (has_per_instance_threads()) {
+    int num_threads = m_num_threads > 0 ? m_num_threads
+                                        : s_default_num_threads.load();
+    apply_num_threads(num_threads > 0 ? num_threads : t_thread_num_threads);
+  }
+
+  // PROCESS TENSOR
+  at::Tensor tensor_out;
+  try {
+    if (block.in_view.defined())
+      block.inputs[0].toTensor().copy_(block.in_view);
+    if (m_device == CPU) {
+      tensor_out = (*block.method)(block.inputs).toTensor();
+    } else {
+      std::vector<torch::jit::IValue> inputs = {
+          block.inputs[0].toTensor().to(m_device)};
+      tensor_out = (*block.method)(inputs).toTensor();
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return;
+  }
+
+  // CHECKS ON TENSOR SHAPE
+  int n_frames = block.out_frames;
+  if (tensor_out.dim() != 3 || tensor_out.size(0) != block.n_batches ||
+      tensor_out.size(1) != block.out_dim || tensor_out.size(2) != n_frames) {
+    std::cout << "model output size is not consistent, expected "
+              << block.n_batches << "x" << block.out_dim << "x" << n_frames
+              << "!\n";
+    return;
+  }
+
+  // the model allocates its output: copied, converted to fp32 and brought
+  // back from the device if needed, with no intermediate tensor
+  try {
+    block.out_view.copy_(tensor_out);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+  }
+}
+
 int Backend::load(std::string path) {
   try {
     auto model = torch::jit::load(path);
-    model.eval();
+    // frozen models have no training attribute left
+    if (model.hasattr("training"))
+      model.eval();
     model.to(m_device);
 
     std::unique_lock<std::mutex> model_lock(m_model_mutex);
@@ -101,6 +333,115 @@ int Backend::load(std::string path) {
   }
 }
 
+static std::set<std::string>
+parameter_names(const torch::jit::Module &module) {
+  std::set<std::string> names;
+  for (const auto &p : module.named_parameters(false))
+    names.insert(p.name);
+  return names;
+}
+
+// shallow copy of a module tree: parameters are shared with src,
+// other attributes (which hold streaming state) are copied
+static torch::jit::Module share_weights(const torch::jit::Module &src) {
+  auto dst = src.copy();
+  auto parameters = parameter_names(src);
+  for (const auto &a : src.named_attributes(false)) {
+    if (a.value.isModule())
+      dst.setattr(a.name, share_weights(a.value.toModule())._ivalue());
+    else if (!parameters.count(a.name))
+      dst.setattr(a.name, a.value.deepcopy());
+  }
+  return dst;
+}
+
+// copy non-parameter attributes of src into dst, which must be a module
+// tree of the same types (e.g. one made by share_weights)
+static void restore_state(torch::jit::Module &dst,
+                          const torch::jit::Module &src) {
+  auto parameters = parameter_names(src);
+  for (const auto &a : src.named_attributes(false)) {
+    if (a.value.isModule()) {
+      auto child = dst.attr(a.name).toModule();
+      restore_state(child, a.value.toModule());
+    } else if (!parameters.count(a.name)) {
+      dst.setattr(a.name, a.value.deepcopy());
+    }
+  }
+}
+
+int Backend::load(Backend &shared) {
+  try {
+    std::unique_lock<std::mutex> shared_lock(shared.m_model_mutex);
+    auto model = share_weights(shared.m_model);
+    auto path = shared.m_path;
+    auto dtype = shared.m_dtype;
+    shared_lock.unlock();
+    model.to(m_device);
+
+    std::unique_lock<std::mutex> model_lock(m_model_mutex);
+    m_model = model;
+    m_dtype = dtype;
+    m_loaded = 1;
+    model_lock.unlock();
+
+    m_available_methods = get_available_methods();
+    m_path = path;
+    return 0;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return 1;
+  }
+}
+
+bool Backend::optimize() {
+  try {
+    std::unique_lock<std::mutex> model_lock(m_model_mutex);
+    // preserving every method keeps get_*/set_* working: attributes mutated
+    // by a preserved method are not folded into constants
+    std::vector<std::string> preserved, perform_methods;
+    for (const auto &m : m_model.get_methods()) {
+      preserved.push_back(m.name());
+      auto params = m.name() + "_params";
+      if (!m_model.hasattr(params))
+        continue;
+      preserved.push_back(params);
+      // forward is always optimized
+      if (m.name() != "forward")
+        perform_methods.push_back(m.name());
+    }
+    auto frozen = torch::jit::freeze(m_model, preserved);
+    m_model = torch::jit::optimize_for_inference(frozen, perform_methods);
+    return true;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return false;
+  }
+}
+
+bool Backend::save(const std::string &path) {
+  try {
+    std::unique_lock<std::mutex> model_lock(m_model_mutex);
+    m_model.save(path);
+    return true;
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << '\n';
+    return false;
+  }
+}
+
+void Backend::save_state() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  m_initial_state = share_weights(m_model);
+}
+
+// reset buffers and attributes to what they were at save_state
+void Backend::reset_state() {
+  std::unique_lock<std::mutex> model_lock(m_model_mutex);
+  if (m_initial_state)
+    restore_state(m_model, *m_initial_state);
+}
+
 int Backend::reload() {
   auto return_code = load(m_path);
   return return_code;
@@ -326,6 +667,57 @@ void Backend::set_attribute(std::string attribute_name,
   }
 }
 
+bool Backend::bind_attribute(AttributeSetter &attribute,
+                             const std::string &attribute_name) {
+  try {
+    std::unique_lock<std::mutex> model_lock(m_model_mutex);
+    auto setter = m_model.get_method("set_" + attribute_name);
+    auto setter_params = m_model.attr(attribute_name + "_params").toTensor();
+    model_lock.unlock();
+
+    std::vector<int> param_types;
+    for (int i = 0; i < setter_params.size(0); i++)
+      param_types.push_back(setter_params[i].item().toInt());
+    // only single numeric values can be set this way
+    if (param_types.size() != 1 || param_types[0] < 0 || param_types[0] > 2)
+      return false;
+
+    attribute.setter = setter;
+    attribute.param_types = param_types;
+    attribute.inputs.assign(param_types.size(), c10::IValue());
+    return true;
+  } catch (...) {
+    return false;
+  }
+}
+
+void Backend::set_attribute(AttributeSetter &attribute, double value) {
+  if (!attribute.is_bound())
+    throw "setter not bound";
+  switch (attribute.param_types[0]) {
+  // bool case
+  case 0:
+    attribute.inputs[0] = c10::IValue(value > 0);
+    break;
+  // int case
+  case 1:
+    attribute.inputs[0] = c10::IValue(static_cast<int64_t>(value));
+    break;
+  // float case
+  default:
+    attribute.inputs[0] = c10::IValue(value);
+    break;
+  }
+  int setter_result;
+  try {
+    setter_result = (*attribute.setter)(attribute.inputs).toInt();
+  } catch (...) {
+    throw "setter failed";
+  }
+  if (setter_result != 0)
+    throw "setter returned -1";
+}
+
 std::vector<int> Backend::get_method_params(std::string method) {
   std::vector<int> params;
 
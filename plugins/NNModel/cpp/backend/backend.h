@@ -1,24 +1,62 @@
 #pragma once
+#include <atomic>
 #include <mutex>
+#include <optional>
 #include <string>
 #include <torch/script.h>
 #include <torch/torch.h>
 #include <vector>
 
+// a model method resolved once, with its planar model blocks bound to it,
+// so that the per-block perform path doesn't need lookups nor tensor
+// building. Blocks hold one value per model frame: input is
+// [n_batches, in_dim, n_vec / in_ratio], output is
+// [n_batches, out_dim, n_vec / out_ratio]
+struct PerformBlock {
+  bool is_bound() const { return method.has_value(); }
+
+  std::optional<torch::jit::Method> method;
+  std::vector<c10::IValue> inputs;
+  // reduced precision models: fp32 input view, converted into inputs
+  at::Tensor in_view;
+  // view of the output buffer, that model outputs are copied into
+  at::Tensor out_view;
+  int n_batches = 0, out_dim = 0, out_frames = 0;
+};
+
+// an attribute setter resolved once, with its parameter types,
+// so that values can be set without string conversions
+struct AttributeSetter {
+  bool is_bound() const { return setter.has_value(); }
+
+  std::optional<torch::jit::Method> setter;
+  std::vector<int> param_types;
+  std::vector<c10::IValue> inputs;
+};
+
 class Backend {
 protected:
   torch::jit::script::Module m_model;
+  // copy of model state, taken by save_state
+  std::optional<torch::jit::script::Module> m_initial_state;
   int m_loaded;
   std::string m_path;
   std::mutex m_model_mutex;
   std::vector<std::string> m_available_methods;
   c10::DeviceType m_device;
   bool m_use_gpu;
+  int m_num_threads;
+  c10::ScalarType m_dtype;
+  static std::atomic<int> s_default_num_threads;
 
 public:
   Backend();
   void perform(std::vector<float *> in_buffer, std::vector<float *> out_buffer,
                int n_vec, std::string method, int n_batches);
+  bool bind(PerformBlock &block, const std::string &method, float *in_buffer,
+            float *out_buffer, int n_vec, int n_batches, int in_dim,
+            int in_ratio, int out_dim, int out_ratio);
+  void perform(PerformBlock &block);
   bool has_method(std::string method_name);
   bool has_settable_attribute(std::string attribute);
   std::vector<std::string> get_available_methods();
@@ -28,12 +66,38 @@ public:
   std::string get_attribute_as_string(std::string attribute_name);
   void set_attribute(std::string attribute_name,
                      std::vector<std::string> attribute_args);
+  bool bind_attribute(AttributeSetter &attribute,
+                      const std::string &attribute_name);
+  void set_attribute(AttributeSetter &attribute, double value);
 
   std::vector<int> get_method_params(std::string method);
   int get_higher_ratio();
   int load(std::string path);
+  int load(Backend &shared);
   int reload();
+  // freeze and optimize perform methods for inference. Other methods and
+  // the attributes they use stay available, mutated attributes stay mutable
+  bool optimize();
+  // convert weights to a reduced precision floating point type. Returns
+  // false, keeping the current precision, if the device doesn't support it
+  bool set_precision(c10::ScalarType dtype);
+  c10::ScalarType get_precision() const { return m_dtype; }
+  // serialize the loaded model, e.g. after optimizing it
+  bool save(const std::string &path);
+  void save_state();
+  void reset_state();
+  bool has_saved_state() const { return m_initial_state.has_value(); }
   bool is_loaded();
   torch::jit::script::Module get_model() { return m_model; }
   void use_gpu(bool value);
+  // intra-op threads used by this instance, 0 for default. Only OpenMP
+  // builds of libtorch can set them per instance: others warn once and use
+  // the default
+  void set_num_threads(int num_threads);
+  static bool has_per_instance_threads();
+  static void set_default_num_threads(int num_threads);
+  // default for instances performing on the calling thread, when neither
+  // they nor set_default_num_threads set one. 0: libtorch's default
+  static void set_thread_num_threads(int num_threads);
+  static bool set_num_interop_threads(int num_threads);
 };
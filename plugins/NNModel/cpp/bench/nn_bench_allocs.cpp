@@ -0,0 +1,193 @@
+// nn_bench_allocs.cpp
+// count heap allocations made by Backend::perform on a bound block, like
+// NNUGen performs on every model block, without a SuperCollider server.
+// Allocations are counted by replacing the global operator new, and by
+// wrapping c10's CPU allocator, which tensor storage comes from
+
+#include "../NNOffline.hpp"
+#include "../backend/backend.h"
+#include <c10/core/CPUAllocator.h>
+#include <torch/version.h>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static std::atomic<bool> gCounting{false};
+static std::atomic<size_t> gAllocs{0}, gBytes{0};
+
+static void* countedAlloc(size_t size, size_t align) {
+  if (gCounting.load(std::memory_order_relaxed)) {
+    gAllocs.fetch_add(1, std::memory_order_relaxed);
+    gBytes.fetch_add(size, std::memory_order_relaxed);
+  }
+  if (size == 0) size = 1;
+  void* ptr = align > alignof(std::max_align_t)
+    ? aligned_alloc(align, (size + align - 1) / align * align)
+    : malloc(size);
+  if (!ptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void* operator new(size_t size) { return countedAlloc(size, 0); }
+void* operator new[](size_t size) { return countedAlloc(size, 0); }
+void* operator new(size_t size, std::align_val_t align) {
+  return countedAlloc(size, static_cast<size_t>(align));
+}
+void* operator new[](size_t size, std::align_val_t align) {
+  return countedAlloc(size, static_cast<size_t>(align));
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+
+// tensor storage on the CPU: counted, then allocated by the default allocator
+static std::atomic<size_t> gTensorAllocs{0}, gTensorBytes{0};
+
+class CountingAllocator final: public c10::Allocator {
+public:
+  explicit CountingAllocator(c10::Allocator* base): m_base(base) {}
+
+// allocate stopped being const, and copy_data was added, in torch 2.3
+#if TORCH_VERSION_MAJOR > 2 || (TORCH_VERSION_MAJOR == 2 && TORCH_VERSION_MINOR >= 3)
+  c10::DataPtr allocate(size_t size) override { return count(size); }
+  void copy_data(void* dest, const void* src, std::size_t size) const override {
+    m_base->copy_data(dest, src, size);
+  }
+#else
+  c10::DataPtr allocate(size_t size) const override { return count(size); }
+#endif
+  c10::DeleterFnPtr raw_deleter() const override { return m_base->raw_deleter(); }
+
+private:
+  c10::DataPtr count(size_t size) const {
+    if (gCounting.load(std::memory_order_relaxed)) {
+      gTensorAllocs.fetch_add(1, std::memory_order_relaxed);
+      gTensorBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+    return m_base->allocate(size);
+  }
+
+  c10::Allocator* m_base;
+};
+
+struct BenchOptions {
+  std::string model;
+  std::string method = "forward";
+  // same meaning as NNUGen's bufferSize: -1 for the model's higher ratio
+  int bufferSize = -1;
+  int batch = 1;
+  int iterations = 1000;
+  int warmup = 10;
+  int threads = 1;
+};
+
+static void usage(const char* name) {
+  fprintf(stderr,
+    "usage: %s -m model.ts [options]\n"
+    "  -m, --model PATH        torchscript model\n"
+    "  -M, --method NAME       method to run (default: forward)\n"
+    "  -b, --buffer-size N     samples per block (default: model's higher ratio)\n"
+    "  -B, --batch N           blocks per pass (default: 1)\n"
+    "  -n, --iterations N      counted perform calls (default: 1000)\n"
+    "  -w, --warmup N          perform calls before counting (default: 10)\n"
+    "  -t, --threads N         intra-op threads (default: 1)\n",
+    name);
+}
+
+static bool parseArgs(int argc, char** argv, BenchOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "nn_bench_allocs: missing value for %s\n", arg.c_str());
+        return nullptr;
+      }
+      return argv[++i];
+    };
+    const char* v = nullptr;
+    if (arg == "-h" || arg == "--help") return false;
+    else if (arg == "-m" || arg == "--model") { if (!(v = value())) return false; options.model = v; }
+    else if (arg == "-M" || arg == "--method") { if (!(v = value())) return false; options.method = v; }
+    else if (arg == "-b" || arg == "--buffer-size") { if (!(v = value())) return false; options.bufferSize = atoi(v); }
+    else if (arg == "-B" || arg == "--batch") { if (!(v = value())) return false; options.batch = atoi(v); }
+    else if (arg == "-n" || arg == "--iterations") { if (!(v = value())) return false; options.iterations = atoi(v); }
+    else if (arg == "-w" || arg == "--warmup") { if (!(v = value())) return false; options.warmup = atoi(v); }
+    else if (arg == "-t" || arg == "--threads") { if (!(v = value())) return false; options.threads = atoi(v); }
+    else {
+      fprintf(stderr, "nn_bench_allocs: unknown option %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return !options.model.empty() && options.iterations > 0 && options.batch > 0;
+}
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  if (!parseArgs(argc, argv, options)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // before loading: every tensor after that is counted
+  static CountingAllocator tensorAllocator(c10::GetCPUAllocator());
+  c10::SetCPUAllocator(&tensorAllocator, std::numeric_limits<uint8_t>::max());
+
+  Backend backend;
+  if (backend.load(options.model)) {
+    fprintf(stderr, "nn_bench_allocs: can't load %s\n", options.model.c_str());
+    return 1;
+  }
+  auto params = backend.get_method_params(options.method);
+  if (params.size() < 4) {
+    fprintf(stderr, "nn_bench_allocs: %s has no method %s\n",
+            options.model.c_str(), options.method.c_str());
+    return 1;
+  }
+  NN::NNModelMethod method(options.method, params);
+  int higherRatio = backend.get_higher_ratio();
+  int bufferSize = NN::OfflineProcessor::resolveBufferSize(options.bufferSize, higherRatio,
+                                                          higherRatio);
+  backend.set_num_threads(options.threads);
+
+  // planar blocks, bound once like NNUGen's
+  std::vector<float> in(options.batch * method.inSize(bufferSize), 0);
+  std::vector<float> out(options.batch * method.outSize(bufferSize), 0);
+  PerformBlock block;
+  if (!backend.bind(block, method.name, in.data(), out.data(), bufferSize, options.batch,
+                    method.inDim, method.inRatio, method.outDim, method.outRatio)) {
+    fprintf(stderr, "nn_bench_allocs: can't bind %s\n", method.name.c_str());
+    return 1;
+  }
+  for (int i = 0; i < options.warmup; ++i) backend.perform(block);
+
+  auto start = Clock::now();
+  gCounting = true;
+  for (int i = 0; i < options.iterations; ++i) backend.perform(block);
+  gCounting = false;
+  std::chrono::duration<double, std::milli> elapsed = Clock::now() - start;
+
+  printf("%s %s: bufferSize %d, batch %d, %d calls, %.3f ms per call\n",
+         options.model.c_str(), method.name.c_str(), bufferSize, options.batch,
+         options.iterations, elapsed.count() / options.iterations);
+  auto report = [&](const char* name, size_t allocs, size_t bytes) {
+    printf("%-15s %zu allocations, %zu bytes (%.1f allocations, %.0f bytes per call)\n",
+           name, allocs, bytes, static_cast<double>(allocs) / options.iterations,
+           static_cast<double>(bytes) / options.iterations);
+  };
+  report("operator new:", gAllocs.load(), gBytes.load());
+  report("tensor storage:", gTensorAllocs.load(), gTensorBytes.load());
+  return 0;
+}
@@ -0,0 +1,199 @@
+// nn_bench_ringbuf.cpp
+// time NNUGen's buffering on its own: inputs written and outputs read every
+// server block, and model blocks exchanged when the input ring is full.
+// Compares RingBuf, one ring over planar memory for all channels, with the
+// per-channel RingBufCtrl it replaced
+
+#include "../NNRingBuffer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+// RingBufCtrl as it was in rt_circular_buffer.h, without the SuperCollider
+// headers: one ring per channel, with modulo wrapping
+template <class in_type, class out_type> class RingBufCtrl {
+public:
+  RingBufCtrl(out_type* buf, size_t size): _buffer(buf), _max_size(size) {}
+
+  bool full() const { return _full; }
+  bool empty() const { return (!_full && _head == _tail); }
+  size_t readable() const {
+    return empty() ? 0 : _head > _tail ? _head - _tail : _max_size - (_tail - _head);
+  }
+
+  void put(const in_type* input_array, int N) {
+    size_t written = 0;
+    while (written < static_cast<size_t>(N)) {
+      int chunkSize = std::min<size_t>(N - written, _max_size - _head);
+      memcpy(&_buffer[_head], &input_array[written], chunkSize * sizeof(out_type));
+      _head = (_head + chunkSize) % _max_size;
+      written += chunkSize;
+    }
+    if (_head == _tail) _full = true;
+  }
+
+  void get(out_type* output_array, int N) {
+    size_t read = 0;
+    size_t bytesToRead = std::min<size_t>(readable(), N);
+    while (read < bytesToRead) {
+      int chunkSize = std::min<size_t>(bytesToRead - read, _max_size - _tail);
+      memcpy(&output_array[read], &_buffer[_tail], chunkSize * sizeof(out_type));
+      _tail = (_tail + chunkSize) % _max_size;
+      read += chunkSize;
+    }
+    if (bytesToRead < static_cast<size_t>(N))
+      memset(&output_array[bytesToRead], 0, sizeof(out_type) * (N - bytesToRead));
+    _full = false;
+  }
+
+protected:
+  out_type* _buffer;
+  size_t _max_size;
+
+  int _head = 0;
+  int _tail = 0;
+  bool _full = false;
+};
+
+struct BenchOptions {
+  int channels = 8;
+  int blockSize = 64;
+  int bufferSize = 2048;
+  int blocks = 1000000;
+};
+
+void usage(const char* name) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -c, --channels N        input and output channels (default: 8)\n"
+    "  -k, --block-size N      server block size (default: 64)\n"
+    "  -b, --buffer-size N     model buffer size, a multiple of the block size (default: 2048)\n"
+    "  -n, --blocks N          server blocks timed (default: 1000000)\n",
+    name);
+}
+
+bool parseArgs(int argc, char** argv, BenchOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "nn_bench_ringbuf: missing value for %s\n", arg.c_str());
+        return nullptr;
+      }
+      return argv[++i];
+    };
+    const char* v = nullptr;
+    if (arg == "-h" || arg == "--help") return false;
+    else if (arg == "-c" || arg == "--channels") { if (!(v = value())) return false; options.channels = atoi(v); }
+    else if (arg == "-k" || arg == "--block-size") { if (!(v = value())) return false; options.blockSize = atoi(v); }
+    else if (arg == "-b" || arg == "--buffer-size") { if (!(v = value())) return false; options.bufferSize = atoi(v); }
+    else if (arg == "-n" || arg == "--blocks") { if (!(v = value())) return false; options.blocks = atoi(v); }
+    else {
+      fprintf(stderr, "nn_bench_ringbuf: unknown option %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return options.channels > 0 && options.blockSize > 0 && options.blocks > 0 &&
+    options.bufferSize >= options.blockSize && options.bufferSize % options.blockSize == 0;
+}
+
+// server block buffers, one per channel like a unit's mInBuf and mOutBuf,
+// and a planar model block where the model would read and write
+struct Signals {
+  Signals(const BenchOptions& options):
+    in(options.channels * options.blockSize), out(in.size()),
+    model(options.channels * options.bufferSize) {
+    for (size_t i = 0; i < in.size(); ++i) in[i] = static_cast<float>(i % 97) / 97;
+    for (int c = 0; c < options.channels; ++c) {
+      inBufs.push_back(&in[c * options.blockSize]);
+      outBufs.push_back(&out[c * options.blockSize]);
+    }
+  }
+  std::vector<float> in, out, model;
+  std::vector<const float*> inBufs;
+  std::vector<float*> outBufs;
+};
+
+// checksum: one output sample per block, enough to tell if both rings
+// diverge without timing a sum over whole blocks
+double benchRingBufCtrl(const BenchOptions& options, double& checksum) {
+  int C = options.channels, N = options.blockSize, B = options.bufferSize;
+  Signals signals(options);
+  std::vector<float> inData(C * B, 0), outData(C * B, 0);
+  std::vector<RingBufCtrl<float, float>> inRings, outRings;
+  for (int c = 0; c < C; ++c) {
+    inRings.emplace_back(&inData[c * B], B);
+    outRings.emplace_back(&outData[c * B], B);
+  }
+  checksum = 0;
+  auto start = Clock::now();
+  for (int k = 0; k < options.blocks; ++k) {
+    for (int c = 0; c < C; ++c) inRings[c].put(signals.inBufs[c], N);
+    if (inRings[0].full()) {
+      // the model is the identity: its output block is its input block
+      for (int c = 0; c < C; ++c) inRings[c].get(&signals.model[c * B], B);
+      for (int c = 0; c < C; ++c) outRings[c].put(&signals.model[c * B], B);
+    }
+    for (int c = 0; c < C; ++c) outRings[c].get(signals.outBufs[c], N);
+    checksum += signals.out[k % signals.out.size()];
+  }
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+double benchRingBuf(const BenchOptions& options, double& checksum) {
+  int C = options.channels, N = options.blockSize, B = options.bufferSize;
+  Signals signals(options);
+  std::vector<float> inData(C * NN::RingBuf::capacity(B), 0);
+  std::vector<float> outData(inData.size(), 0);
+  NN::RingBuf inRing(inData.data(), C, B), outRing(outData.data(), C, B);
+  checksum = 0;
+  auto start = Clock::now();
+  for (int k = 0; k < options.blocks; ++k) {
+    inRing.put(signals.inBufs.data(), N);
+    if (inRing.full()) {
+      inRing.get(signals.model.data(), B, B);
+      outRing.put(signals.model.data(), B, B);
+    }
+    outRing.get(signals.outBufs.data(), N);
+    checksum += signals.out[k % signals.out.size()];
+  }
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  BenchOptions options;
+  if (!parseArgs(argc, argv, options)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  double ctrlSum, ringSum;
+  // once untimed, to fault in pages and warm caches
+  BenchOptions warmup = options;
+  warmup.blocks = std::min(options.blocks, 1000);
+  benchRingBufCtrl(warmup, ctrlSum);
+  benchRingBuf(warmup, ringSum);
+
+  double ctrlNs = benchRingBufCtrl(options, ctrlSum);
+  double ringNs = benchRingBuf(options, ringSum);
+  printf("%d channels, block size %d, buffer size %d, %d blocks\n",
+         options.channels, options.blockSize, options.bufferSize, options.blocks);
+  printf("RingBufCtrl: %8.1f ns per block\n", ctrlNs / options.blocks);
+  printf("RingBuf:     %8.1f ns per block (%.2fx)\n", ringNs / options.blocks,
+         ctrlNs / ringNs);
+  if (ctrlSum != ringSum) {
+    fprintf(stderr, "nn_bench_ringbuf: outputs differ (%f, %f)\n", ctrlSum, ringSum);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,517 @@
+// nn_daemon.cpp
+// inference server for several scsynth or supernova processes on the same
+// host. Each model is loaded once, and its instances share its weights.
+// Blocks of stateless methods, from all channels of the same method and
+// bufferSize, are processed together as a batch on one instance. Streaming
+// methods, and channels with attributes, get an instance each: their state
+// and attributes are their own. Servers talk to it through shared memory,
+// see NNRemote.hpp
+
+#include "../NNModel.hpp"
+#include "../NNOffline.hpp"
+#include "../NNRemote.hpp"
+#include "../backend/backend.h"
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace NN::Remote;
+using Clock = std::chrono::steady_clock;
+
+struct DaemonOptions {
+  std::string name = "nn";
+  // intra-op threads per group, 0 for libtorch's default
+  int threads = 0;
+  bool verbose = false;
+};
+
+static std::atomic<bool> gRunning{true};
+
+static void usage(const char* name) {
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -n, --name NAME         name servers load models with (default: nn)\n"
+    "  -t, --threads N         intra-op threads per model method (default: libtorch's)\n"
+    "  -v, --verbose           print channels opening and closing\n",
+    name);
+}
+
+static bool parseArgs(int argc, char** argv, DaemonOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "nn_daemon: missing value for %s\n", arg.c_str());
+        return nullptr;
+      }
+      return argv[++i];
+    };
+    const char* v = nullptr;
+    if (arg == "-h" || arg == "--help") return false;
+    else if (arg == "-n" || arg == "--name") { if (!(v = value())) return false; options.name = v; }
+    else if (arg == "-t" || arg == "--threads") { if (!(v = value())) return false; options.threads = atoi(v); }
+    else if (arg == "-v" || arg == "--verbose") options.verbose = true;
+    else {
+      fprintf(stderr, "nn_daemon: unknown option %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+// channels of a model method and bufferSize on one model instance, with a
+// thread of its own. Only stateless methods of channels without attributes
+// are shared by several channels, batching whichever blocks are pending:
+// other groups have a single channel
+class Group {
+public:
+  static constexpr int maxBatchSize = 64;
+  using Key = std::tuple<std::string, std::string, int>;
+
+  Group(Key key, Counter& doorbell, double blockDuration, bool exclusive):
+    m_key(std::move(key)), m_doorbell(doorbell), m_blockDuration(blockDuration),
+    m_exclusive(exclusive) {}
+  ~Group() { stop(); }
+
+  const Key& key() const { return m_key; }
+  // load an instance sharing weights with the model, probe whether its
+  // method is stateless, and start processing
+  bool start(Backend& shared, int threads, int warmup);
+  void stop();
+  // whether other channels can join
+  bool isShared();
+  // returns the channel's slot, -1 if the group is full or doesn't match
+  // the channel's blocks
+  int join(ChannelSegment* channel);
+  // once returned, the group doesn't touch the channel anymore
+  void leave(int slot);
+  bool empty();
+
+private:
+  struct Member {
+    ChannelSegment* channel = nullptr;
+    // last block processed, and last submitted
+    uint32_t done = 0, submitted = 0;
+  };
+
+  void loop();
+  // members with a block to process, under m_mutex
+  uint64_t collect();
+  void process(uint64_t pending);
+  void setAttributes(ChannelSegment& channel);
+  PerformBlock& reserve(int n_batches);
+
+  Key m_key;
+  Counter& m_doorbell;
+  double m_blockDuration;
+  bool m_exclusive, m_stateless = false;
+  std::unique_ptr<NN::NNModelMethod> m_method;
+  Backend m_model;
+  std::vector<float> m_inBatch, m_outBatch;
+  // one per batch size, bound on first use
+  std::vector<PerformBlock> m_blocks;
+  std::map<std::string, AttributeSetter> m_setters;
+  std::array<Member, maxBatchSize> m_members;
+  uint64_t m_active = 0;
+  std::mutex m_mutex;
+  std::atomic<bool> m_running{false};
+  std::thread m_thread;
+};
+
+bool Group::start(Backend& shared, int threads, int warmup) {
+  const auto& methodName = std::get<1>(m_key);
+  auto params = shared.get_method_params(methodName);
+  if (params.size() < 4 || m_model.load(shared)) return false;
+  m_method = std::make_unique<NN::NNModelMethod>(methodName, params);
+  m_model.set_num_threads(threads);
+  // same probe as offline processing: batches only if state doesn't change
+  int bufferSize = std::get<2>(m_key);
+  NN::OfflineProcessor probe(m_model, *m_method, bufferSize, 2);
+  m_stateless = probe.prepare() && probe.batchSize() > 1;
+  auto& block = reserve(1);
+  for (int i = 0; i < warmup; ++i)
+    m_model.perform(block);
+  m_running = true;
+  m_thread = std::thread(&Group::loop, this);
+  return true;
+}
+
+void Group::stop() {
+  if (!m_thread.joinable()) return;
+  m_running = false;
+  m_doorbell.fetch_add(1);
+  futexWake(m_doorbell);
+  m_thread.join();
+}
+
+bool Group::isShared() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return !m_exclusive && m_stateless && std::popcount(m_active) < maxBatchSize;
+}
+
+int Group::join(ChannelSegment* channel) {
+  int bufferSize = std::get<2>(m_key);
+  if (channel->inSize != m_method->inSize(bufferSize) ||
+      channel->outSize != m_method->outSize(bufferSize))
+    return -1;
+  std::lock_guard<std::mutex> lock(m_mutex);
+  // streaming state and attributes belong to the first channel
+  int maxMembers = (m_exclusive || !m_stateless) ? 1 : maxBatchSize;
+  for (int slot = 0; slot < maxMembers; ++slot) {
+    if ((m_active >> slot) & 1) continue;
+    uint32_t submitted = channel->submitted.load();
+    m_members[slot] = { channel, submitted, submitted };
+    m_active |= uint64_t(1) << slot;
+    return slot;
+  }
+  return -1;
+}
+
+void Group::leave(int slot) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_active &= ~(uint64_t(1) << slot);
+  m_members[slot] = Member();
+}
+
+bool Group::empty() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_active == 0;
+}
+
+uint64_t Group::collect() {
+  uint64_t pending = 0;
+  for (int slot = 0; slot < maxBatchSize; ++slot) {
+    if (!((m_active >> slot) & 1)) continue;
+    auto& member = m_members[slot];
+    member.submitted = member.channel->submitted.load(std::memory_order_acquire);
+    if (member.submitted != member.done) pending |= uint64_t(1) << slot;
+  }
+  return pending;
+}
+
+// staging buffers only grow, so that steady state doesn't allocate
+PerformBlock& Group::reserve(int n_batches) {
+  int bufferSize = std::get<2>(m_key);
+  if (n_batches >= m_blocks.size()) {
+    int capacity = std::bit_ceil(static_cast<unsigned>(n_batches));
+    m_inBatch.assign(capacity * m_method->inSize(bufferSize), 0);
+    m_outBatch.assign(capacity * m_method->outSize(bufferSize), 0);
+    // rebind all blocks to the new buffers
+    m_blocks.assign(capacity + 1, PerformBlock());
+  }
+  auto& block = m_blocks[n_batches];
+  if (!block.is_bound())
+    m_model.bind(block, m_method->name,
+                 m_inBatch.data(), m_outBatch.data(), bufferSize, n_batches,
+                 m_method->inDim, m_method->inRatio,
+                 m_method->outDim, m_method->outRatio);
+  return block;
+}
+
+// only exclusive groups have channels with attributes
+void Group::setAttributes(ChannelSegment& channel) {
+  int numAttributes = std::min(channel.numAttributes, maxAttributes);
+  for (int i = 0; i < numAttributes; ++i) {
+    auto& attr = channel.attributes[i];
+    attr.name[maxNameLength - 1] = '\0';
+    auto& setter = m_setters[attr.name];
+    try {
+      if (!setter.is_bound() && !m_model.bind_attribute(setter, attr.name))
+        throw "setter not found";
+      m_model.set_attribute(setter, attr.value);
+    } catch (...) {
+      fprintf(stderr, "nn_daemon: can't set attribute %s\n", attr.name);
+    }
+  }
+}
+
+void Group::process(uint64_t pending) {
+  if (!pending) return;
+  // only pending blocks: batch indices don't matter to stateless methods,
+  // and other groups have a single member
+  int n_batches = std::popcount(pending);
+  auto& block = reserve(n_batches);
+  int bufferSize = std::get<2>(m_key);
+  size_t inSize = m_method->inSize(bufferSize);
+  size_t outSize = m_method->outSize(bufferSize);
+
+  std::array<int, maxBatchSize> slots;
+  for (int b = 0, slot = 0; b < n_batches; ++slot) {
+    if (!((pending >> slot) & 1)) continue;
+    auto& channel = *m_members[slot].channel;
+    memcpy(&m_inBatch[b * inSize], channel.inModel(), inSize * sizeof(float));
+    if (channel.numAttributes > 0) setAttributes(channel);
+    slots[b++] = slot;
+  }
+
+  m_model.perform(block);
+
+  for (int b = 0; b < n_batches; ++b) {
+    auto& member = m_members[slots[b]];
+    memcpy(member.channel->outModel(), &m_outBatch[b * outSize],
+           outSize * sizeof(float));
+    member.done = member.submitted;
+    member.channel->completed.store(member.done, std::memory_order_release);
+    futexWake(member.channel->completed);
+  }
+}
+
+void Group::loop() {
+  // servers don't share block boundaries: wait at most one block for the
+  // other members to submit theirs
+  auto blockDuration = std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double>(m_blockDuration));
+  while (m_running) {
+    // doorbell before members: a block submitted after collecting rings it
+    uint32_t bell = m_doorbell.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    uint64_t pending = collect();
+    if (!pending) {
+      lock.unlock();
+      futexWait(m_doorbell, bell, std::chrono::milliseconds(200));
+      continue;
+    }
+    auto deadline = Clock::now() + blockDuration;
+    while (std::popcount(pending) < std::popcount(m_active)) {
+      auto left = deadline - Clock::now();
+      if (left <= left.zero()) break;
+      lock.unlock();
+      futexWait(m_doorbell, bell, left);
+      bell = m_doorbell.load(std::memory_order_acquire);
+      lock.lock();
+      pending = collect();
+    }
+    process(pending);
+  }
+}
+
+// owns the daemon segment: opens and closes channels on clients' requests,
+// in groups loaded on demand
+class Daemon {
+public:
+  explicit Daemon(const DaemonOptions& options): m_options(options) {}
+  ~Daemon();
+
+  bool start();
+  void run();
+
+private:
+  struct Channel {
+    ChannelSegment* segment = nullptr;
+    size_t size = 0;
+    int group = -1, slot = -1;
+  };
+
+  void update(bool checkClients);
+  void openChannel(int idx);
+  void closeChannel(int idx);
+  // group for a channel's model method and bufferSize, started if needed.
+  // Returns its doorbell index, -1 on errors
+  int findGroup(const ChannelSegment& channel);
+  void dropGroup(int idx);
+  void dropModel(const std::string& path);
+
+  DaemonOptions m_options;
+  std::string m_segmentName;
+  DaemonSegment* m_segment = nullptr;
+  std::array<Channel, maxChannels> m_channels;
+  // by doorbell index
+  std::array<std::unique_ptr<Group>, maxGroups> m_groups;
+  // loaded once, shared by all groups of a model
+  std::map<std::string, std::shared_ptr<Backend>> m_models;
+};
+
+Daemon::~Daemon() {
+  for (int idx = 0; idx < maxChannels; ++idx) closeChannel(idx);
+  // group threads ring their doorbells in the segment
+  for (auto& group: m_groups) group.reset();
+  if (m_segment) {
+    unmapSegment(m_segment, sizeof(DaemonSegment));
+    shm_unlink(m_segmentName.c_str());
+  }
+}
+
+bool Daemon::start() {
+  m_segmentName = daemonSegmentName(m_options.name.c_str());
+  size_t size = sizeof(DaemonSegment);
+  // a segment left by a daemon that didn't exit cleanly is replaced
+  if (auto old = static_cast<DaemonSegment*>(mapSegment(m_segmentName, size, false))) {
+    bool running = old->magic == magic && isRunning(old->pid);
+    unmapSegment(old, size);
+    if (running) {
+      fprintf(stderr, "nn_daemon: %s is already running\n", m_options.name.c_str());
+      return false;
+    }
+    shm_unlink(m_segmentName.c_str());
+  }
+  size = sizeof(DaemonSegment);
+  m_segment = static_cast<DaemonSegment*>(mapSegment(m_segmentName, size, true));
+  if (m_segment == nullptr) {
+    fprintf(stderr, "nn_daemon: can't create %s\n", m_segmentName.c_str());
+    return false;
+  }
+  m_segment->pid = getpid();
+  std::atomic_thread_fence(std::memory_order_release);
+  m_segment->magic = magic;
+  return true;
+}
+
+void Daemon::run() {
+  printf("nn_daemon: running as %s\n", m_options.name.c_str());
+  bool checkClients = false;
+  while (gRunning) {
+    uint32_t requests = m_segment->requests.load(std::memory_order_acquire);
+    update(checkClients);
+    // clients that exited without closing their channels are found when idle
+    checkClients = !futexWait(m_segment->requests, requests, std::chrono::milliseconds(200));
+  }
+}
+
+void Daemon::update(bool checkClients) {
+  for (int idx = 0; idx < maxChannels; ++idx) {
+    auto& entry = m_segment->channels[idx];
+    uint32_t state = entry.state.load(std::memory_order_acquire);
+    bool open = m_channels[idx].segment != nullptr;
+    if (state == channelRequested && !open) {
+      openChannel(idx);
+    } else if (state == channelClosing ||
+               (open && checkClients && !isRunning(entry.clientPid))) {
+      closeChannel(idx);
+      entry.state.store(channelFree, std::memory_order_release);
+    }
+  }
+}
+
+void Daemon::openChannel(int idx) {
+  auto& entry = m_segment->channels[idx];
+  char name[maxNameLength];
+  memcpy(name, entry.segment, maxNameLength);
+  name[maxNameLength - 1] = '\0';
+  size_t size = sizeof(ChannelSegment);
+  auto segment = static_cast<ChannelSegment*>(mapSegment(name, size, false));
+  int group = -1, slot = -1;
+  if (segment && size >= ChannelSegment::size(segment->inSize, segment->outSize)) {
+    segment->path[maxPathLength - 1] = '\0';
+    segment->method[maxNameLength - 1] = '\0';
+    group = findGroup(*segment);
+    if (group >= 0) slot = m_groups[group]->join(segment);
+  }
+
+  uint32_t expected = channelRequested;
+  if (slot < 0) {
+    if (segment) unmapSegment(segment, size);
+    if (group >= 0) dropGroup(group);
+    // the client frees failed entries, or has already given up on it
+    if (!entry.state.compare_exchange_strong(expected, channelFailed))
+      entry.state.store(channelFree);
+    futexWake(entry.state);
+    fprintf(stderr, "nn_daemon: can't open channel %s\n", name);
+    return;
+  }
+
+  m_channels[idx] = { segment, size, group, slot };
+  entry.group = group;
+  if (!entry.state.compare_exchange_strong(expected, channelOpen,
+                                           std::memory_order_release)) {
+    closeChannel(idx);
+    entry.state.store(channelFree);
+    return;
+  }
+  futexWake(entry.state);
+  if (m_options.verbose)
+    printf("nn_daemon: opened %s: %s %s, bufferSize %d, group %d\n", name,
+           segment->path, segment->method, segment->bufferSize, group);
+}
+
+void Daemon::closeChannel(int idx) {
+  auto& channel = m_channels[idx];
+  if (channel.segment == nullptr) return;
+  m_groups[channel.group]->leave(channel.slot);
+  dropGroup(channel.group);
+  unmapSegment(channel.segment, channel.size);
+  if (m_options.verbose)
+    printf("nn_daemon: closed channel %d\n", idx);
+  channel = Channel();
+}
+
+int Daemon::findGroup(const ChannelSegment& channel) {
+  Group::Key key(channel.path, channel.method, channel.bufferSize);
+  int free = -1;
+  for (int idx = 0; idx < maxGroups; ++idx) {
+    if (!m_groups[idx]) { if (free < 0) free = idx; continue; }
+    if (!channel.exclusive && m_groups[idx]->key() == key && m_groups[idx]->isShared())
+      return idx;
+  }
+  if (free < 0) {
+    fprintf(stderr, "nn_daemon: too many model instances (%d)\n", maxGroups);
+    return -1;
+  }
+
+  auto& model = m_models[channel.path];
+  if (!model) {
+    printf("nn_daemon: loading %s\n", channel.path);
+    model = std::make_shared<Backend>();
+    if (model->load(channel.path)) {
+      fprintf(stderr, "nn_daemon: can't load %s\n", channel.path);
+      m_models.erase(channel.path);
+      return -1;
+    }
+  }
+  auto group = std::make_unique<Group>(key, m_segment->doorbells[free],
+                                       channel.blockDuration, channel.exclusive);
+  if (!group->start(*model, m_options.threads, channel.warmup)) {
+    fprintf(stderr, "nn_daemon: can't run %s in %s\n", channel.method, channel.path);
+    dropModel(channel.path);
+    return -1;
+  }
+  m_groups[free] = std::move(group);
+  return free;
+}
+
+// unload groups without channels, and models without groups
+void Daemon::dropGroup(int idx) {
+  if (!m_groups[idx]->empty()) return;
+  std::string path = std::get<0>(m_groups[idx]->key());
+  m_groups[idx].reset();
+  dropModel(path);
+}
+
+void Daemon::dropModel(const std::string& path) {
+  for (auto& group: m_groups)
+    if (group && std::get<0>(group->key()) == path) return;
+  m_models.erase(path);
+  if (m_options.verbose)
+    printf("nn_daemon: unloaded %s\n", path.c_str());
+}
+
+int main(int argc, char** argv) {
+  DaemonOptions options;
+  if (!parseArgs(argc, argv, options)) {
+    usage(argv[0]);
+    return 1;
+  }
+  // waits are at most 200ms: loops see gRunning soon enough
+  auto stop = [](int) { gRunning = false; };
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  Daemon daemon(options);
+  if (!daemon.start()) return 1;
+  daemon.run();
+  printf("nn_daemon: stopped\n");
+  return 0;
+}
@@ -0,0 +1,248 @@
+// nn_render.cpp
+// render sound files through a model method, without a SuperCollider server.
+// Inputs are decimated and outputs held per model frame like in NNUGen,
+// files are processed in parallel, each on its own model instance
+
+#include "../NNOffline.hpp"
+#include "../backend/backend.h"
+#include <sndfile.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+struct RenderOptions {
+  std::string model;
+  std::string method = "forward";
+  std::string outDir = ".";
+  // same meaning as for /nn_process_buffer
+  int bufferSize = -1;
+  int batch = 8;
+  // files rendered at once, 0 for one per core
+  int jobs = 0;
+  // intra-op threads per file, 0 to share cores between jobs
+  int threads = 0;
+  std::vector<std::string> files;
+};
+
+static void usage(const char* name) {
+  fprintf(stderr,
+    "usage: %s -m model.ts [options] file...\n"
+    "  -m, --model PATH        torchscript model\n"
+    "  -M, --method NAME       method to run (default: forward)\n"
+    "  -o, --out-dir DIR       output directory (default: .)\n"
+    "  -b, --buffer-size N     samples per chunk (default: 65536)\n"
+    "  -B, --batch N           chunks per pass for stateless methods (default: 8)\n"
+    "  -j, --jobs N            files rendered in parallel (default: one per core)\n"
+    "  -t, --threads N         intra-op threads per file (default: cores / jobs)\n",
+    name);
+}
+
+static bool parseArgs(int argc, char** argv, RenderOptions& options) {
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "nn_render: missing value for %s\n", arg.c_str());
+        return nullptr;
+      }
+      return argv[++i];
+    };
+    const char* v = nullptr;
+    if (arg == "-h" || arg == "--help") return false;
+    else if (arg == "-m" || arg == "--model") { if (!(v = value())) return false; options.model = v; }
+    else if (arg == "-M" || arg == "--method") { if (!(v = value())) return false; options.method = v; }
+    else if (arg == "-o" || arg == "--out-dir") { if (!(v = value())) return false; options.outDir = v; }
+    else if (arg == "-b" || arg == "--buffer-size") { if (!(v = value())) return false; options.bufferSize = atoi(v); }
+    else if (arg == "-B" || arg == "--batch") { if (!(v = value())) return false; options.batch = atoi(v); }
+    else if (arg == "-j" || arg == "--jobs") { if (!(v = value())) return false; options.jobs = atoi(v); }
+    else if (arg == "-t" || arg == "--threads") { if (!(v = value())) return false; options.threads = atoi(v); }
+    else if (arg.size() > 1 && arg[0] == '-') {
+      fprintf(stderr, "nn_render: unknown option %s\n", arg.c_str());
+      return false;
+    }
+    else options.files.push_back(arg);
+  }
+  return !options.model.empty() && !options.files.empty();
+}
+
+// like NNUGen's input ring: keep the last sample of each frame. Returns the
+// number of frames
+static size_t decimate(const float* audio, size_t numSamples, int channels,
+                       int ratio, float* frames) {
+  size_t numFrames = numSamples / ratio;
+  for (size_t f = 0; f < numFrames; ++f)
+    std::copy_n(&audio[((f + 1) * ratio - 1) * channels], channels, &frames[f * channels]);
+  return numFrames;
+}
+
+// like NNUGen's output ring: hold each frame for ratio samples, silent
+// past the last frame
+static void hold(const float* frames, size_t numFrames, int channels, int ratio,
+                 size_t numSamples, float* audio) {
+  std::fill_n(audio, numSamples * channels, 0);
+  for (size_t n = 0; n < numSamples && n / ratio < numFrames; ++n)
+    std::copy_n(&frames[(n / ratio) * channels], channels, &audio[n * channels]);
+}
+
+struct RenderResult {
+  double duration = 0, elapsed = 0;
+  int batch = 0;
+  bool ok = false;
+};
+
+// files are streamed a model pass at a time: batch chunks of bufferSize
+// samples, processed as if the whole file was read at once
+static RenderResult render(Backend& backend, const NN::NNModelMethod& method,
+                           const RenderOptions& options, int higherRatio,
+                           const std::string& path) {
+  RenderResult result;
+  SF_INFO inInfo{};
+  SNDFILE* in = sf_open(path.c_str(), SFM_READ, &inInfo);
+  if (!in) {
+    fprintf(stderr, "nn_render: can't open %s: %s\n", path.c_str(), sf_strerror(nullptr));
+    return result;
+  }
+  if (inInfo.channels != method.inDim) {
+    fprintf(stderr, "nn_render: %s has %d channels, %s needs %d\n",
+            path.c_str(), inInfo.channels, method.name.c_str(), method.inDim);
+    sf_close(in);
+    return result;
+  }
+
+  int bufferSize = NN::OfflineProcessor::resolveBufferSize(options.bufferSize, higherRatio);
+  NN::OfflineProcessor processor(backend, method, bufferSize, options.batch);
+  if (!processor.prepare()) {
+    fprintf(stderr, "nn_render: can't bind %s\n", method.name.c_str());
+    sf_close(in);
+    return result;
+  }
+
+  auto outPath = fs::path(options.outDir) /
+    (fs::path(path).stem().string() + "_" + method.name + ".wav");
+  SF_INFO outInfo{};
+  outInfo.samplerate = inInfo.samplerate;
+  outInfo.channels = method.outDim;
+  outInfo.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+  SNDFILE* out = sf_open(outPath.string().c_str(), SFM_WRITE, &outInfo);
+  if (!out) {
+    fprintf(stderr, "nn_render: can't write %s: %s\n", outPath.string().c_str(), sf_strerror(nullptr));
+    sf_close(in);
+    return result;
+  }
+
+  // a pass is a whole number of chunks, and so of model frames
+  size_t passSamples = static_cast<size_t>(bufferSize) * processor.batchSize();
+  std::vector<float> audio(passSamples * method.inDim);
+  std::vector<float> inFrames(passSamples / method.inRatio * method.inDim);
+  int passOutFrames = processor.outFrames(passSamples / method.inRatio);
+  std::vector<float> outFrames(static_cast<size_t>(passOutFrames) * method.outDim);
+  std::vector<float> output(passSamples * method.outDim);
+  sf_count_t numSamples = 0, n;
+  bool ok = true;
+  while (ok && (n = sf_readf_float(in, audio.data(), passSamples)) > 0) {
+    auto start = Clock::now();
+    size_t numInFrames = decimate(audio.data(), n, method.inDim, method.inRatio,
+                                  inFrames.data());
+    processor.process(inFrames.data(), numInFrames, outFrames.data(), passOutFrames);
+    // as long as the input: padding to whole chunks is dropped
+    hold(outFrames.data(), passOutFrames, method.outDim, method.outRatio, n, output.data());
+    result.elapsed += std::chrono::duration<double>(Clock::now() - start).count();
+    numSamples += n;
+    if (sf_writef_float(out, output.data(), n) != n) {
+      fprintf(stderr, "nn_render: can't write %s: %s\n", outPath.string().c_str(), sf_strerror(out));
+      ok = false;
+    }
+  }
+  sf_close(in);
+  sf_close(out);
+  if (!ok) return result;
+
+  result.duration = static_cast<double>(numSamples) / inInfo.samplerate;
+  result.batch = processor.batchSize();
+  result.ok = true;
+  return result;
+}
+
+int main(int argc, char** argv) {
+  RenderOptions options;
+  if (!parseArgs(argc, argv, options)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  Backend shared;
+  if (shared.load(options.model)) {
+    fprintf(stderr, "nn_render: can't load %s\n", options.model.c_str());
+    return 1;
+  }
+  auto params = shared.get_method_params(options.method);
+  if (params.size() < 4) {
+    fprintf(stderr, "nn_render: %s has no method %s\n",
+            options.model.c_str(), options.method.c_str());
+    return 1;
+  }
+  NN::NNModelMethod method(options.method, params);
+  int higherRatio = shared.get_higher_ratio();
+
+  int cores = std::max(1u, std::thread::hardware_concurrency());
+  int jobs = options.jobs > 0 ? options.jobs : cores;
+  jobs = std::min<int>(jobs, options.files.size());
+  int threads = options.threads > 0 ? options.threads : std::max(1, cores / jobs);
+  std::error_code ec;
+  fs::create_directories(options.outDir, ec);
+
+  // each job takes the next file, on a model instance sharing weights
+  std::atomic<size_t> next{0};
+  std::vector<RenderResult> results(options.files.size());
+  std::mutex printMutex;
+  auto start = Clock::now();
+  std::vector<std::thread> workers;
+  for (int j = 0; j < jobs; ++j) {
+    workers.emplace_back([&, j]() {
+      Backend backend;
+      if (backend.load(shared)) {
+        // its files are rendered by the other jobs
+        std::lock_guard<std::mutex> lock(printMutex);
+        fprintf(stderr, "nn_render: can't create a model instance for job %d\n", j);
+        return;
+      }
+      backend.set_num_threads(threads);
+      // every file starts from the model's initial streaming state
+      backend.save_state();
+      for (size_t i; (i = next.fetch_add(1)) < options.files.size();) {
+        auto& path = options.files[i];
+        backend.reset_state();
+        results[i] = render(backend, method, options, higherRatio, path);
+        if (!results[i].ok) continue;
+        std::lock_guard<std::mutex> lock(printMutex);
+        printf("%s: %.1fs in %.2fs (%.1fx real time, batch %d)\n", path.c_str(),
+               results[i].duration, results[i].elapsed,
+               results[i].duration / results[i].elapsed, results[i].batch);
+      }
+    });
+  }
+  for (auto& w: workers) w.join();
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+  double duration = 0;
+  int failed = 0;
+  for (const auto& r: results) {
+    duration += r.duration;
+    if (!r.ok) ++failed;
+  }
+  printf("rendered %zu files, %.1fs of audio in %.2fs: %.1fx real time "
+         "(%d jobs, %d threads each)\n", results.size() - failed, duration,
+         elapsed, duration / elapsed, jobs, threads);
+  return failed > 0 ? 1 : 0;
+}
@@ -43,7 +43,7 @@ NN {
 		};
 	}
 
-	*load { |key, path, id(-1), server(Server.default), action|
+	*load { |key, path, id(-1), server(Server.default), action, options|
 		var model = this.model(key);
 		if (path.isKindOf(String).not) {
 			Error("NN.load: path needs to be a string, got: %").format(path).throw
@@ -54,9 +54,10 @@ NN {
 					Error("NN.load (nrt): model info not found for %".format(path)).throw;
 				};
 				model = NNModel.fromInfo(info, this.nextModelID);
+				model.loadOptions = options;
 				this.prPut(key, model);
 			} {
-				model = NNModel.load(path, id, server, action: { |m|
+				model = NNModel.load(path, id, server, options: options, action: { |m|
 				this.prPut(key, m);
 					// call action after adding to registry: in case action needs key
 					action.value(m);
@@ -77,11 +78,60 @@ NN {
 		}
 	}
 
-	*loadMsg { |id, path, infoFile|
-		^["/cmd", "/nn_load", id, path.standardizePath, infoFile.standardizePath]
+	// timings of all running NNUGens. Prints them on the server if action
+	// is nil, otherwise calls it with an Array of Dictionaries, one per UGen
+	*stats { |action, reset=false, server(Server.default)|
+		var outFile = action !? { PathName.tmp +/+ "nn-stats-" ++ UniqueID.next ++ ".yaml" };
+		forkIfNeeded {
+			server.sync(bundles:[this.statsMsg(outFile, reset)]);
+			outFile !? {
+				protect {
+					action.(File.readAllString(outFile).parseYAML ?? { [] })
+				} {
+					File.delete(outFile)
+				}
+			}
+		}
+	}
+
+	// options: an Event of load options, e.g. (threads: 2, autotune: true).
+	// The server notifies /nn_loaded with replyID when done
+	*loadMsg { |id, path, infoFile, options, replyID|
+		^["/cmd", "/nn_load", id, path.standardizePath, (infoFile ? "").standardizePath]
+		++ this.prOptionPairs(options)
+		++ (replyID !? { ["replyID", replyID] } ?? { [] })
+	}
+	*prOptionPairs { |options|
+		^(options ?? { () }).asPairs.collect { |x|
+			case
+			{ x.isKindOf(Boolean) } { x.binaryValue }
+			{ x.isString } { x.standardizePath }
+			{ x }
+		}
+	}
+	// default intra-op threads for models loaded without a threads option,
+	// and inter-op threads (only effective before any model has run).
+	// -1 leaves the current setting unchanged
+	*threadsMsg { |intraOp(-1), interOp(-1)|
+		^["/cmd", "/nn_threads", intraOp, interOp]
+	}
+	*threads { |intraOp(-1), interOp(-1), server(Server.default)|
+		server.sendMsg(*this.threadsMsg(intraOp, interOp))
+	}
+	// with a replyID, the server sends the model's info back with /nn_info
+	*dumpInfoMsg { |modelIdx, outFile, replyID(-1)|
+		^["/cmd", "/nn_query", modelIdx ? -1, outFile ? "", replyID]
+	}
+	// The server notifies /nn_pooled with replyID when done
+	*poolMsg { |modelIdx, methodIdx, bufferSize(-1), count(1), warmup(1), replyID(-1)|
+		^["/cmd", "/nn_pool", modelIdx, methodIdx, bufferSize, count, warmup, replyID]
+	}
+	*statsMsg { |outFile, reset=false|
+		^["/cmd", "/nn_stats", outFile ? "", reset.binaryValue]
 	}
-	*dumpInfoMsg { |modelIdx, outFile|
-		^["/cmd", "/nn_query", modelIdx ? -1, outFile ? ""]
+	// The server notifies /nn_processed with replyID when done
+	*processBufferMsg { |modelIdx, methodIdx, srcBufNum, dstBufNum, bufferSize(-1), batch(8), replyID(-1)|
+		^["/cmd", "/nn_process_buffer", modelIdx, methodIdx, srcBufNum, dstBufNum, bufferSize, batch, replyID]
 	}
 	// *setMsg { |modelIdx, attrIdx, value|
 	// 	^["/cmd", "/nn_set", modelIdx, attrIdx, value.asString]
@@ -6,6 +6,7 @@ NNModel {
 
 	var <server, <path, <idx, <info, <methods;
 	var <isLoaded=false;
+	var <>loadOptions;
 
 	*new { ^nil }
 
@@ -25,11 +26,17 @@ NNModel {
 	}
 
 	doOnServerBoot {
-		server.sendMsg(*this.loadMsg)
+		var cond = Condition(), replyID = UniqueID.next;
+		// /sync doesn't wait for models loading in the background: hold the
+		// boot routine until /nn_loaded, so that ServerTree functions can
+		// already play the model
+		OSCFunc({ cond.unhang }, '/nn_loaded', server.addr, argTemplate: [nil, replyID]).oneShot;
+		server.sendMsg(*NN.loadMsg(idx, path, nil, loadOptions, replyID));
+		if (thisThread.isKindOf(Routine)) { cond.hang };
 	}
 
-	*load { |path, id(-1), server(Server.default), action|
-		var loadMsg, infoFile, model;
+	*load { |path, id(-1), server(Server.default), action, options|
+		var loadMsg, model, replyID = UniqueID.next;
 		path = path.standardizePath;
 		if (server.serverRunning.not) {
 			Error("server not running").throw
@@ -38,25 +45,31 @@ NNModel {
 			Error("model file '%' not found".format(path)).throw
 		};
 
-		if (infoFile.isNil) {
-			var infoID = UniqueID.next; 
-			infoFile = PathName.tmp +/+ "nn-sc-" ++ infoID ++ ".yaml"
-		};
-
-		loadMsg = NN.loadMsg(id, path, infoFile);
+		// info comes back with /nn_loaded
+		loadMsg = NN.loadMsg(id, path, nil, options, replyID);
 
 		model = super.newCopyArgs(server);
+		model.loadOptions = options;
 
 		forkIfNeeded {
-			server.sync(bundles: [loadMsg]);
-			// server writes info file: read it
-			protect { 
-				model.initFromFile(infoFile);
-				ServerBoot.add(model, server);
-				action.(model)
+			var cond = Condition(), reply;
+			// models load in the background on the server: wait for its
+			// notification rather than for /sync
+			OSCFunc({ |msg|
+				reply = msg;
+				cond.unhang;
+			}, '/nn_loaded', server.addr, argTemplate: [nil, replyID]).oneShot;
+			server.sendMsg(*loadMsg);
+			cond.hang;
+			if (reply[4] <= 0) { Error("NNModel: server couldn't load '%'".format(path)).throw };
+			if (reply.size > 5) {
+				model.prInitLoaded(NNModelInfo.fromReply(reply[5..]));
 			} {
-				File.delete(infoFile);
-			}
+				// too much info for a reply: fall back to a file
+				model.prInitFromServerFile(reply[3].asInteger);
+			};
+			ServerBoot.add(model, server);
+			action.(model)
 		};
 
 		^model;
@@ -70,11 +83,25 @@ NNModel {
 	}
 
 	initFromFile { |infoFile|
-		var info = NNModelInfo.fromFile(infoFile);
+		this.prInitLoaded(NNModelInfo.fromFile(infoFile));
+	}
+
+	prInitLoaded { |info|
 		this.initFromInfo(info);
 		NN.prCacheInfo(info);
 	}
 
+	// only works when sclang and the server share a file system
+	prInitFromServerFile { |modelIdx|
+		var infoFile = PathName.tmp +/+ "nn-sc-" ++ UniqueID.next ++ ".yaml";
+		server.sync(bundles: [NN.dumpInfoMsg(modelIdx, infoFile)]);
+		protect {
+			this.initFromFile(infoFile)
+		} {
+			File.delete(infoFile)
+		}
+	}
+
 	initFromInfo { |infoObj, overrideId|
 		info = infoObj;
 		path = info.path;
@@ -83,7 +110,7 @@ NNModel {
 	}
 
 	loadMsg { |newPath, infoFile|
-		^NN.loadMsg(idx, newPath ? path, infoFile)
+		^NN.loadMsg(idx, newPath ? path, infoFile, loadOptions)
 	}
 
 	dumpInfoMsg { |outFile| ^NN.dumpInfoMsg(this.idx, outFile) }
@@ -126,6 +153,10 @@ NNModelInfo {
 	*fromDict { |infoDict|
 		^super.new.initFromDict(infoDict);
 	}
+	// from the values of a server reply, see NNModelDesc::encodeInfo
+	*fromReply { |values|
+		^super.new.initFromReply(values);
+	}
 	initFromDict { |yaml|
 		idx = yaml["idx"].asInteger;
 		path = yaml["modelPath"];
@@ -134,28 +165,159 @@ NNModelInfo {
 			var name = m["name"].asSymbol;
 			var inDim = m["inDim"].asInteger;
 			var outDim = m["outDim"].asInteger;
-			NNModelMethod(nil, name, n, inDim, outDim);
+			var inRatio = m["inRatio"].asInteger;
+			var outRatio = m["outRatio"].asInteger;
+			var measures = ["tuned", "frozen", "quantized"].collectAs({ |key|
+				key.asSymbol -> m[key]
+			}, Event).reject(_.isNil);
+			NNModelMethod(nil, name, n, inDim, outDim, measures, inRatio, outRatio);
 		};
 		attributes = yaml["attributes"].collect(_.asSymbol) ?? { [] }
 	}
 
+	initFromReply { |values|
+		var pos = 0, format;
+		var next = { pos = pos + 1; values[pos - 1] };
+		var nextInt = { next.value.asInteger };
+		// length, then one byte per value
+		var nextString = {
+			var size = nextInt.value;
+			var str = String.newFrom(values.copyRange(pos, pos + size - 1).collect { |c| c.asInteger.asAscii });
+			pos = pos + size;
+			str
+		};
+		format = nextInt.value;
+		if (format != 2) { Error("NNModelInfo: unknown info format %".format(format)).throw };
+		idx = nextInt.value;
+		minBufferSize = nextInt.value;
+		// threads, frozen and quantized flags, precision: not used by sclang
+		3.do { next.value };
+		path = nextString.value;
+		methods = nextInt.value.collect { |n|
+			var name = nextString.value.asSymbol;
+			var inDim = nextInt.value, inRatio = nextInt.value;
+			var outDim = nextInt.value, outRatio = nextInt.value;
+			var tunedThreads = nextInt.value, tunedBufferSize = nextInt.value, tunedBlockMs = next.value;
+			var frozenBlockMs = next.value, unfrozenBlockMs = next.value;
+			var quantizedBlockMs = next.value, fp32BlockMs = next.value, snrDb = next.value;
+			var fp32Rms = next.value, rmsError = next.value;
+			// same measures as in info files, present when taken
+			var measures = ();
+			// threads are 0 when only the buffer size was tuned
+			if (tunedBufferSize > 0) {
+				measures[\tuned] = (
+					threads: if (tunedThreads > 0) { tunedThreads } { "default" },
+					bufferSize: tunedBufferSize, blockMs: tunedBlockMs
+				)
+			};
+			if (frozenBlockMs > 0) {
+				measures[\frozen] = (blockMs: frozenBlockMs, unfrozenBlockMs: unfrozenBlockMs)
+			};
+			if (quantizedBlockMs > 0) {
+				measures[\quantized] = (blockMs: quantizedBlockMs, fp32BlockMs: fp32BlockMs, rmsError: rmsError);
+				// no SNR when the fp32 output is silent
+				if (fp32Rms > 0) { measures[\quantized][\snrDb] = snrDb };
+			};
+			NNModelMethod(nil, name, n, inDim, outDim, measures, inRatio, outRatio);
+		};
+		// names, then their type
+		attributes = nextInt.value.collect {
+			var name = nextString.value.asSymbol;
+			next.value;
+			name
+		};
+	}
+
 	describe {
 		"path: %".format(this.path).postln;
 		"minBufferSize: %".format(this.minBufferSize).postln;
 		this.methods.do { |m|
 			"- method %: % ins, % outs".format(m.name, m.numInputs, m.numOutputs).postln;
+			m.measures.keysValuesDo { |key, measure|
+				"  %: %".format(key, measure).postln;
+			};
 		};
 		"".postln;
 	}
 }
 
 NNModelMethod {
-	var <model, <name, <idx, <numInputs, <numOutputs;
+	// measures: timings reported by the server at load (tuned, frozen, quantized)
+	// inRatio, outRatio: samples per model frame of inputs and outputs
+	var <model, <name, <idx, <numInputs, <numOutputs, <measures, <inRatio, <outRatio;
 
 	*new { |...args| ^super.newCopyArgs(*args) }
 
 	copyForModel { |model|
-		^this.class.newCopyArgs(model, name, idx, numInputs, numOutputs)
+		^this.class.newCopyArgs(model, name, idx, numInputs, numOutputs, measures, inRatio, outRatio)
+	}
+
+	poolMsg { |count=1, bufferSize(-1), warmup=1, replyID(-1)|
+		^NN.poolMsg(model.idx, idx, bufferSize, count, warmup, replyID)
+	}
+	pool { |count=1, bufferSize(-1), warmup=1|
+		var server = model.server;
+		model.prErrIfNoServer("pool");
+		forkIfNeeded {
+			var cond = Condition(), replyID = UniqueID.next;
+			// instances are prepared in the background on the server: wait for
+			// its notification rather than for /sync
+			OSCFunc({ cond.unhang }, '/nn_pooled', server.addr,
+				argTemplate: [nil, replyID]).oneShot;
+			server.sendMsg(*this.poolMsg(count, bufferSize, warmup, replyID));
+			cond.hang;
+		}
+	}
+
+	// number of frames written by processBuffer for a source of numFrames
+	// frames: whole chunks of bufferSize samples, one frame per outRatio samples
+	processBufferFrames { |numFrames, bufferSize(-1)|
+		var minBufferSize = model.minBufferSize;
+		var numChunks;
+		case
+		{ bufferSize < 0 } { bufferSize = 65536 }
+		{ bufferSize < minBufferSize } { bufferSize = minBufferSize }
+		{ bufferSize = bufferSize.nextPowerOfTwo };
+		numChunks = (numFrames / (bufferSize div: inRatio)).roundUp.asInteger;
+		^numChunks * (bufferSize div: outRatio)
+	}
+	processBufferMsg { |srcBuf, dstBuf, bufferSize(-1), batch=8, replyID(-1)|
+		^NN.processBufferMsg(model.idx, idx, srcBuf.bufnum, dstBuf.bufnum, bufferSize, batch, replyID)
+	}
+	// run this method over a whole Buffer, faster than real time, into dstBuf,
+	// or a new Buffer if nil. Buffers hold one frame per model frame.
+	// action is called with dstBuf when done
+	processBuffer { |srcBuf, dstBuf, bufferSize(-1), batch=8, action|
+		var server = model.server;
+		model.prErrIfNoServer("processBuffer");
+		forkIfNeeded {
+			var cond = Condition(), replyID = UniqueID.next;
+			dstBuf = dstBuf ?? {
+				Buffer.alloc(server, this.processBufferFrames(srcBuf.numFrames, bufferSize), numOutputs)
+			};
+			server.sync;
+			// buffers are processed in the background on the server: wait for
+			// its notification rather than for /sync
+			OSCFunc({ cond.unhang }, '/nn_processed', server.addr,
+				argTemplate: [nil, replyID]).oneShot;
+			server.sendMsg(*this.processBufferMsg(srcBuf, dstBuf, bufferSize, batch, replyID));
+			cond.hang;
+			action.value(dstBuf);
+		}
+	}
+	// same as processBuffer, reading the source from a sound file
+	processFile { |path, dstBuf, bufferSize(-1), batch=8, action|
+		var server = model.server;
+		model.prErrIfNoServer("processFile");
+		forkIfNeeded {
+			var cond = Condition();
+			var srcBuf = Buffer.read(server, path.standardizePath, action: { cond.unhang });
+			cond.hang;
+			this.processBuffer(srcBuf, dstBuf, bufferSize, batch) { |dst|
+				srcBuf.free;
+				action.value(dst);
+			}
+		}
 	}
 
 	printOn { |stream|
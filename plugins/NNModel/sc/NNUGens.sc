@@ -1,11 +1,17 @@
 NNUGen : MultiOutUGen {
 
-	// enum UGenInputs { modelIdx=0, methodIdx, bufSize, warmup, debug, inputs };
-	*ar { |modelIdx, methodIdx, bufferSize, numOutputs, warmup, debug, inputs|
-		^this.new1('audio', modelIdx, methodIdx, bufferSize, warmup, debug, *inputs)
+	// enum UGenInputs { modelIdx=0, methodIdx, bufSize, warmup, debug, batch, pipeline, inputs };
+	*ar { |modelIdx, methodIdx, bufferSize, numOutputs, warmup, debug, batch, pipeline, inputs|
+		^this.new1('audio', modelIdx, methodIdx, bufferSize, warmup, debug, batch, pipeline, *inputs)
 			.initOutputs(numOutputs, 'audio');
 	}
 
+	// one value per control period: model frames are held for outRatio / blockSize periods
+	*kr { |modelIdx, methodIdx, bufferSize, numOutputs, warmup, debug, batch, pipeline, inputs|
+		^this.new1('control', modelIdx, methodIdx, bufferSize, warmup, debug, batch, pipeline, *inputs)
+			.initOutputs(numOutputs, 'control');
+	}
+
 	checkInputs {
 		// modelIdx, methodIdx and bufferSize are not modulatable
 		['modelIdx', 'methodIdx', 'bufferSize'].do { |name, n|
@@ -19,7 +25,16 @@ NNUGen : MultiOutUGen {
 
 + NNModelMethod {
 
-	ar { |inputs, bufferSize(-1), warmup=0, debug=0, attributes(#[])|
+	ar { |inputs, bufferSize(-1), warmup=0, debug=0, attributes(#[]), batch=0, pipeline=1|
+		^this.prMakeUGen(\ar, inputs, bufferSize, warmup, debug, attributes, batch, pipeline)
+	}
+
+	// latent-rate processing: the method's ratios must be multiples of the server's blockSize
+	kr { |inputs, bufferSize(-1), warmup=0, debug=0, attributes(#[]), batch=0, pipeline=1|
+		^this.prMakeUGen(\kr, inputs, bufferSize, warmup, debug, attributes, batch, pipeline)
+	}
+
+	prMakeUGen { |rate, inputs, bufferSize, warmup, debug, attributes, batch, pipeline|
 		var attrParams;
 		inputs = inputs.asArray;
 		if (inputs.size != this.numInputs) {
@@ -27,12 +42,34 @@ NNUGen : MultiOutUGen {
 				.format(this.name, this.numInputs, inputs.size)).throw
 		};
 
+		// \auto: chosen by the server from the method's measured costs
+		if (bufferSize == \auto) { bufferSize = -2 };
+
 		attrParams = Array(attributes.size);
 		attributes.pairsDo { |attrName, attrValue|
 			attrParams.add(model.attrIdx(attrName));
 			attrParams.add(attrValue ?? 0);
 		};
 
-		^NNUGen.ar(model.idx, idx, bufferSize, this.numOutputs, warmup, debug, inputs ++ attrParams)
+		^NNUGen.perform(rate, model.idx, idx, bufferSize, this.numOutputs, warmup, debug, batch, pipeline, inputs ++ attrParams)
+	}
+
+	// delay in samples between a UGen's inputs and outputs, as set up by the
+	// server for these arguments. Doesn't include the model's own latency.
+	// For \auto, the lowest the server can choose
+	latency { |bufferSize(-1), pipeline=1, batch=0, blockSize|
+		var minBufferSize = model.minBufferSize;
+		blockSize = blockSize ?? { model.server.options.blockSize };
+		if (bufferSize == \auto) {
+			bufferSize = minBufferSize;
+			while { bufferSize < blockSize } { bufferSize = bufferSize * 2 };
+			^bufferSize - blockSize
+		};
+		case
+		{ bufferSize == 0 } { ^minBufferSize - blockSize }
+		{ bufferSize < minBufferSize } { bufferSize = minBufferSize }
+		{ bufferSize = bufferSize.nextPowerOfTwo };
+		if (batch > 0) { pipeline = 1 };
+		^(pipeline.clip(1, 16) + 1) * bufferSize - blockSize
 	}
 }
@@ -10,6 +10,8 @@ NNNRTEnv {
 
 +NN {
 
+	// infoFile: models info written by NN.dumpInfo. If nil, info of the
+	// models loaded on real-time servers, as received from them
 	*nrt { |infoFile, makeBundleFn|
 		^Environment[\nn_nrt -> NNNRTEnv()].use { 
 			NN.prReadInfoFile(infoFile);
@@ -18,6 +20,10 @@ NNNRTEnv {
 	}
 
 	*prReadInfoFile { |infoFile|
+		if (infoFile.isNil) {
+			rtModelsInfo.do { |info| this.prCacheInfo(info) };
+			^this
+		};
 		if (File.exists(infoFile).not) {
 			Error("NNModel: can't load info file '%'".format(infoFile)).throw;
 		} {